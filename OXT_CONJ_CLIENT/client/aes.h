@@ -100,6 +100,20 @@ static void aes128_dec(__m128i *key_schedule, uint8_t *cipherText,uint8_t *plain
     _mm_storeu_si128((__m128i *) plainText, m);
 }
 
+//Expanded key schedule, built once per key and shared read-only by the worker threads of a batch.
+//rk[0..10] are the encryption round keys, rk[11..19] the decryption ones (AES_LoadKey only).
+struct AESKeySchedule {
+    __m128i rk[20];
+};
+
+int AES_LoadKey(AESKeySchedule *ks,const uint8_t *key);
+int AES_LoadKeyEncOnly(AESKeySchedule *ks,const uint8_t *key);
+int AESENC_N(const AESKeySchedule *ks,uint8_t *ctext,const uint8_t *ptext,size_t n);
+int AESDEC_N(const AESKeySchedule *ks,uint8_t *ptext,const uint8_t *ctext,size_t n);
+//Bulk kernel chosen at startup for AESENC_N: "vaes512", "vaes256" or "aesni x8"
+const char *AES_KernelName();
+
+//Single block calls, each expands the key
 int AESENC(uint8_t *ctext,uint8_t *ptext,uint8_t *key);
 int AESDEC(uint8_t *ptext,uint8_t *ctext,uint8_t *key);
 int PRF_K(uint8_t *prf_out,uint8_t *ptext);
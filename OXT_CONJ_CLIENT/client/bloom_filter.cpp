@@ -1,102 +1,241 @@
 #include "bloom_filter.h"
 
-int BloomFilter_Init(unsigned char** &BF)
+#include <cstdlib>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Backing storage of the blocks, either a heap block or a read-only file mapping
+static unsigned char *bf_storage = nullptr;
+static size_t bf_map_len = 0;
+
+#define BF_CHECKSUM_SEED 0xcbf29ce484222325ULL
+
+static uint64_t BloomFilter_Checksum(uint64_t h, const unsigned char *data, size_t len)
+{
+    for(size_t i=0;i<len;++i){
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static size_t BloomFilter_Bytes()
+{
+    return (size_t)BloomFilter_Blocks() * BF_BLOCK_BYTES;
+}
+
+static int BloomFilter_ReleaseStorage()
+{
+    if(bf_map_len != 0){
+        ::munmap(bf_storage,bf_map_len);
+    }
+    else{
+        ::free(bf_storage);
+    }
+    bf_storage = nullptr;
+    bf_map_len = 0;
+    return 0;
+}
+
+unsigned int BloomFilter_Blocks()
+{
+    size_t n_bits = (size_t)N_HASH * MAX_BF_BIN_SIZE;
+    size_t block_bits = (size_t)BF_BLOCK_BYTES * 8;
+    return (n_bits + block_bits - 1) / block_bits;
+}
+
+//The block of a run comes from the top 32 bits of the digest of its first probe
+//(multiply-shift range reduction), probe j uses 9 bits of digest j after those 32 bits
+int BloomFilter_Indices(unsigned char *bhash, unsigned int* indices)
+{
+    unsigned int n_blocks = BloomFilter_Blocks();
+    unsigned int group = BF_PROBE_GROUPS;
+    unsigned int block = 0;
+
+    for(unsigned int k=0;k<N_HASH;++k){
+        unsigned char *digest = bhash + (64*k);
+        if((k*BF_PROBE_GROUPS)/N_HASH != group){
+            group = (k*BF_PROBE_GROUPS)/N_HASH;
+            uint32_t top = ((uint32_t)digest[0] << 24) | ((uint32_t)digest[1] << 16) | ((uint32_t)digest[2] << 8) | digest[3];
+            block = ((uint64_t)top * n_blocks) >> 32;
+        }
+        unsigned int offset = (((unsigned int)digest[4] << 8) | digest[5]) >> (16 - BF_BLOCK_BITS_LOG);
+        indices[k] = (block << BF_BLOCK_BITS_LOG) | offset;
+    }
+    return 0;
+}
+
+int BloomFilter_Init(unsigned char* &BF)
+{
+    size_t n_bytes = BloomFilter_Bytes();
+    void *mem = nullptr;
+
+    if(::posix_memalign(&mem,BF_BLOCK_BYTES,n_bytes) != 0){
+        std::cout << "Could not allocate the bloom filter" << std::endl;
+        BF = nullptr;
+        return -1;
+    }
+
+    bf_storage = static_cast<unsigned char*>(mem);
+    bf_map_len = 0;
+    ::memset(bf_storage,0x00,n_bytes);
+
+    BF = bf_storage;
+    return 0;
+}
+
+int BloomFilter_Set(unsigned char* &BF, unsigned int* indices)
 {
-    BF = new unsigned char* [N_HASH];
     for(unsigned int k=0;k<N_HASH;++k){
-        BF[k] = new unsigned char [MAX_BF_BIN_SIZE];
-        ::memset(BF[k],0x00,MAX_BF_BIN_SIZE);
+        BF[indices[k] >> 3] |= (0x01 << (indices[k] & 0x07));
     }
     return 0;
 }
 
-int BloomFilter_Set(unsigned char** &BF, unsigned int* indices)
+int BloomFilter_Set_N(unsigned char* &BF, unsigned int** indices, int n_idx)
 {
     for(unsigned int k=0;k<N_HASH;++k){
-        BF[k][indices[k]] = 0x01;
+        BF[indices[k][n_idx] >> 3] |= (0x01 << (indices[k][n_idx] & 0x07));
     }
     return 0;
 }
 
-int BloomFilter_Set_N(unsigned char** &BF, unsigned int** indices, int n_idx)
+int BloomFilter_SetAtomic(unsigned char* &BF, unsigned int* indices)
 {
+    //Bits only ever get set, so no ordering is needed between the updates
     for(unsigned int k=0;k<N_HASH;++k){
-        BF[k][indices[k][n_idx]] = 0x01;
+        __atomic_fetch_or(&BF[indices[k] >> 3],(unsigned char)(0x01 << (indices[k] & 0x07)),__ATOMIC_RELAXED);
     }
     return 0;
 }
 
-int BloomFilter_Match(unsigned char** &BF, unsigned int* indices, bool* is_present)
+int BloomFilter_Match(unsigned char* &BF, unsigned int* indices, bool* is_present)
 {
     bool is_in_part = true;
     for(size_t k=0;k<N_HASH;++k){
-        is_in_part &= ((BF[k])[indices[k]] == 0x01);
+        is_in_part &= ((BF[indices[k] >> 3] >> (indices[k] & 0x07)) & 0x01);
     }
     *is_present = is_in_part;
     return 0;
 }
 
-int BloomFilter_Match_N(unsigned char** &BF, unsigned int** indices, unsigned int n_words, bool* is_present)
+//Word-major so that consecutive probes stay in one block of the word
+int BloomFilter_Match_N(unsigned char* &BF, unsigned int** indices, unsigned int n_words, bool* is_present)
 {
     bool is_in_part = true;
-    for(size_t k=0;k<N_HASH;++k){
-        for(size_t l=0;l<n_words;++l){
-            is_in_part &= ((BF[k])[indices[k][l]] == 0x01);
+    for(size_t l=0;l<n_words;++l){
+        for(size_t k=0;k<N_HASH;++k){
+            is_in_part &= ((BF[indices[k][l] >> 3] >> (indices[k][l] & 0x07)) & 0x01);
         }
     }
     *is_present = is_in_part;
     return 0;
 }
 
-int BloomFilter_Clean(unsigned char** &BF)
+int BloomFilter_Clean(unsigned char* &BF)
 {
-    for(size_t k=0;k<N_HASH;++k){
-        delete [] BF[k];
-    }
-    delete [] BF;
+    BloomFilter_ReleaseStorage();
+    BF = nullptr;
     return 0;
 }
 
-int BloomFilter_WriteBFtoFile(std::string bloomfilter_file, unsigned char** &BF)
+int BloomFilter_WriteBFtoFile(std::string bloomfilter_file, unsigned char* &BF)
 {
-    std::ofstream outputfile;
-    outputfile.open(bloomfilter_file,std::ios_base::out);
+    size_t n_bytes = BloomFilter_Bytes();
 
-    for(unsigned int i=0;i<N_HASH;++i){
-        for(unsigned int j=0;j<MAX_BF_BIN_SIZE;++j){
-            outputfile << std::hex << std::setw(2) << std::setfill('0') << (static_cast<int>(BF[i][j]) & 0xFF) << "\n";
-        }
+    unsigned char header_block[BF_FILE_HEADER_SIZE];
+    BloomFilterHeader header;
+    ::memset(header_block,0x00,BF_FILE_HEADER_SIZE);
+    ::memset(&header,0x00,sizeof(header));
+
+    ::memcpy(header.magic,BF_FILE_MAGIC,8);
+    header.version = BF_FILE_VERSION;
+    header.n_hash = N_HASH;
+    header.n_bf_bits = N_BF_BITS;
+    header.n_blocks = BloomFilter_Blocks();
+    header.checksum = BloomFilter_Checksum(BF_CHECKSUM_SEED,BF,n_bytes);
+    ::memcpy(header_block,&header,sizeof(header));
+
+    //Written under a temporary name and renamed, a failed write never replaces the last good filter
+    std::string tmp_file = bloomfilter_file + ".tmp";
+
+    std::ofstream outputfile;
+    outputfile.open(tmp_file,std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if(!outputfile.is_open()){
+        std::cout << "Could not open " << tmp_file << " for writing" << std::endl;
+        return -1;
     }
 
+    outputfile.write(reinterpret_cast<const char*>(header_block),BF_FILE_HEADER_SIZE);
+    outputfile.write(reinterpret_cast<const char*>(BF),n_bytes);
+    bool failed = outputfile.fail();
+
     outputfile.close();
+    failed |= outputfile.fail();
+
+    if(failed || ::rename(tmp_file.data(),bloomfilter_file.data()) < 0){
+        std::cout << "Could not write " << bloomfilter_file << std::endl;
+        ::unlink(tmp_file.data());
+        return -1;
+    }
+
     return 0;
 }
 
-int BloomFilter_ReadBFfromFile(std::string bloomfilter_file, unsigned char** &BF)
+int BloomFilter_ReadBFfromFile(std::string bloomfilter_file, unsigned char* &BF)
 {
-    std::ifstream inputfile;
-    inputfile.open(bloomfilter_file,std::ios_base::in);
-
-    std::string fline;
-    char temp[2];
-    const char *tstr;
-    unsigned int n_hash = 0;
-    unsigned int bf_idx = 0;
-
-    while(std::getline(inputfile,fline) && (n_hash < N_HASH)){
-        tstr = fline.data();
-        temp[0] = tstr[0];
-        temp[1] = tstr[1];
-        BF[n_hash][bf_idx] = std::strtoul(temp,nullptr,16) & 0xFF;
-        fline.clear();
-        bf_idx++;
-        if(bf_idx == MAX_BF_BIN_SIZE){
-            n_hash++;
-            bf_idx = 0;
-        }
+    size_t n_bytes = BloomFilter_Bytes();
+    size_t file_len = BF_FILE_HEADER_SIZE + n_bytes;
+
+    int fd = ::open(bloomfilter_file.data(),O_RDONLY);
+    if(fd < 0){
+        std::cout << "Could not open " << bloomfilter_file << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if(::fstat(fd,&st) < 0 || (size_t)st.st_size != file_len){
+        std::cout << "Bloom filter file " << bloomfilter_file << " has unexpected size" << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    void *map = ::mmap(nullptr,file_len,PROT_READ,MAP_SHARED,fd,0);
+    ::close(fd);
+    if(map == MAP_FAILED){
+        std::cout << "Could not map " << bloomfilter_file << std::endl;
+        return -1;
     }
 
-    inputfile.close();
+    unsigned char *base = static_cast<unsigned char*>(map);
+    BloomFilterHeader header;
+    ::memcpy(&header,base,sizeof(header));
+
+    if(::memcmp(header.magic,BF_FILE_MAGIC,8) != 0 || header.version != BF_FILE_VERSION ||
+       header.n_hash != (uint32_t)N_HASH || header.n_bf_bits != (uint32_t)N_BF_BITS || header.n_blocks != BloomFilter_Blocks()){
+        std::cout << "Bloom filter file " << bloomfilter_file << " does not match the configuration" << std::endl;
+        ::munmap(map,file_len);
+        return -1;
+    }
+
+    if(BloomFilter_Checksum(BF_CHECKSUM_SEED,base+BF_FILE_HEADER_SIZE,n_bytes) != header.checksum){
+        std::cout << "Bloom filter file " << bloomfilter_file << " failed checksum" << std::endl;
+        ::munmap(map,file_len);
+        return -1;
+    }
+
+    ::madvise(map,file_len,MADV_RANDOM);
+
+    //Swap the (empty) heap blocks for the mapping
+    BloomFilter_ReleaseStorage();
+    bf_storage = base;
+    bf_map_len = file_len;
+
+    BF = base + BF_FILE_HEADER_SIZE;
 
 	return 0;
 }
@@ -1,16 +1,48 @@
 #include <cstring>
+#include <cstdint>
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include "size_parameters.h"
 
-int BloomFilter_Init(unsigned char** &BF);
-int BloomFilter_Set(unsigned char** &BF, unsigned int* indices);
-int BloomFilter_Set_N(unsigned char** &BF, unsigned int** indices, int n_idx);
-int BloomFilter_Match(unsigned char** &BF, unsigned int* indices, bool* is_present);
-int BloomFilter_Match_N(unsigned char** &BF, unsigned int** indices, unsigned int n_words, bool* is_present);
-int BloomFilter_Clean(unsigned char** &BF);
+//Blocked layout: the filter is an array of 512 bit (one cache line) blocks holding
+//the same N_HASH*MAX_BF_BIN_SIZE bits as before. The N_HASH probes of one element
+//are split into BF_PROBE_GROUPS runs of consecutive probes, each run in one block,
+//indices passed to Set/Match are absolute bit positions.
+#define BF_BLOCK_BYTES 64
+#define BF_BLOCK_BITS_LOG 9
+//A single block per element lets uneven block loads dominate the false positive
+//rate, four blocks of 6 probes keep it near the unblocked filter (db6k: 3.7e-9)
+#define BF_PROBE_GROUPS 4
 
-int BloomFilter_WriteBFtoFile(std::string bloomfilter_file, unsigned char** &BF);
-int BloomFilter_ReadBFfromFile(std::string bloomfilter_file, unsigned char** &BF);
+//On-disk format: a 64 byte header followed by the blocks, bit i at byte i>>3, bit i&7
+#define BF_FILE_MAGIC "OXTBLOOM"
+#define BF_FILE_VERSION 3
+#define BF_FILE_HEADER_SIZE 64
+
+struct BloomFilterHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_hash;
+    uint32_t n_bf_bits;
+    uint32_t n_blocks;
+    uint64_t checksum;//FNV-1a over all blocks
+};
+
+unsigned int BloomFilter_Blocks();
+int BloomFilter_Indices(unsigned char *bhash, unsigned int* indices);
+
+int BloomFilter_Init(unsigned char* &BF);
+int BloomFilter_Set(unsigned char* &BF, unsigned int* indices);
+int BloomFilter_Set_N(unsigned char* &BF, unsigned int** indices, int n_idx);
+//Same as BloomFilter_Set, safe for concurrent insertions into one filter
+int BloomFilter_SetAtomic(unsigned char* &BF, unsigned int* indices);
+int BloomFilter_Match(unsigned char* &BF, unsigned int* indices, bool* is_present);
+int BloomFilter_Match_N(unsigned char* &BF, unsigned int** indices, unsigned int n_words, bool* is_present);
+int BloomFilter_Clean(unsigned char* &BF);
+
+//Writes the binary format, -1 if the file could not be written completely;
+//reading maps the file read-only and points BF into it
+int BloomFilter_WriteBFtoFile(std::string bloomfilter_file, unsigned char* &BF);
+int BloomFilter_ReadBFfromFile(std::string bloomfilter_file, unsigned char* &BF);
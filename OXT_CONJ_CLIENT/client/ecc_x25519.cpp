@@ -1,120 +1,295 @@
 #include "ecc_x25519.h"
 
-mpz_class ECC_Prime = mpz_class{"57896044618658097711785492504343953926634992332820282019728792003956564819949",10};//2^255-19
-mpz_class ECC_InvExp = mpz_class{"57896044618658097711785492504343953926634992332820282019728792003956564819947",10};//2^255-19-2
+//Outputs may alias P2/P3, every input limb is read before the output it aliases is written
+int DoubleAndAdd(fe25519 &P4x,fe25519 &P4z,fe25519 &P5x,fe25519 &P5z, const fe25519 &P2x,const fe25519 &P2z,const fe25519 &P3x,const fe25519 &P3z,const fe25519 &X1){
+
+    fe25519 T0, T1, T2, T3, T4, T5;
+
+    fe_add(T0,P2x,P2z);
+    fe_sub(T1,P2x,P2z);
+    fe_sq(T3,T1);
+    fe_sq(T4,T0);
+    fe_add(T2,P3x,P3z);
+    fe_mul(T1,T2,T1);
+    fe_sub(T2,P3x,P3z);
+    fe_mul(T0,T2,T0);
+
+    fe_mul(P4x,T4,T3);
+
+    fe_sub(T2,T4,T3);
+    fe_mul_small(T4,T2,121666);
+    fe_add(T5,T0,T1);
+    fe_sub(T0,T0,T1);
+    fe_sq(P5x,T5);
+    fe_sq(T0,T0);
+    fe_add(T4,T3,T4);
+    fe_mul(P4z,T2,T4);
+    fe_mul(P5z,X1,T0);
 
-int DoubleAndAdd(mpz_class &P4x,mpz_class &P4z,mpz_class &P5x,mpz_class &P5z, mpz_class P2x,mpz_class P2z,mpz_class P3x,mpz_class P3z,mpz_class X1){
-
-    mpz_class a24(121666);
-
-    mpz_class T0(0);
-    mpz_class T1(0);
-    mpz_class T2(0);
-    mpz_class T3(0);
-    mpz_class T4(0);
-    mpz_class T5(0);
+    return 0;
+}
 
-    T0 = P2x + P2z;
-    mpz_mod(T0.get_mpz_t(),T0.get_mpz_t(),ECC_Prime.get_mpz_t());
+int ScalarMul(unsigned char *product, unsigned char *scalar, unsigned char *basep){
 
-    T1 = P2x - P2z;
-    mpz_mod(T1.get_mpz_t(),T1.get_mpz_t(),ECC_Prime.get_mpz_t());
+    fe25519 pc;
+    fe25519 p1x, p1z;
+    fe25519 p2x, p2z;
+    fe25519 zinv;
 
-    T3 = T1 * T1;
-    mpz_mod(T3.get_mpz_t(),T3.get_mpz_t(),ECC_Prime.get_mpz_t());
+    fe_frombytes(pc,basep);
 
-    T4 = T0 * T0;
-    mpz_mod(T4.get_mpz_t(),T4.get_mpz_t(),ECC_Prime.get_mpz_t());
+    p1x = pc;
+    fe_1(p1z);
+    fe_1(p2x);
+    fe_0(p2z);
 
-    T2  = P3x + P3z;
-    mpz_mod(T2.get_mpz_t(),T2.get_mpz_t(),ECC_Prime.get_mpz_t());
+    //Leading zero bits keep p2 at the identity, so the ladder can run over all 256 bits
+    for(int i=255;i>=0;--i){
+        int bit = (scalar[31-(i>>3)] >> (i&7)) & 1;
+        if(bit) DoubleAndAdd(p1x,p1z,p2x,p2z,p1x,p1z,p2x,p2z,pc);
+        else DoubleAndAdd(p2x,p2z,p1x,p1z,p2x,p2z,p1x,p1z,pc);
+    }
 
-    T1 = T2 * T1;
-    mpz_mod(T1.get_mpz_t(),T1.get_mpz_t(),ECC_Prime.get_mpz_t());
+    fe_invert(zinv,p2z);
+    fe_mul(p2x,p2x,zinv);
+    fe_tobytes(product,p2x);
 
-    P4x = T4 * T3;
-    mpz_mod(P4x.get_mpz_t(),P4x.get_mpz_t(),ECC_Prime.get_mpz_t());
+    return 0;
+}
 
-    T2 = P3x - P3z;
-    mpz_mod(T2.get_mpz_t(),T2.get_mpz_t(),ECC_Prime.get_mpz_t());
+//Fixed-base multiples of the base point u = 9 go through its twisted Edwards form
+//-x^2 + y^2 = 1 + d x^2 y^2, where u = (1+y)/(1-y), with a table of small multiples
+//in 64 radix-16 positions (the ref10 layout). The complete Edwards addition needs no
+//ladder: a full scalar costs about 64 mixed additions and 4 doublings.
+
+//Extended coordinates x = X/Z, y = Y/Z, T = XY/Z
+struct EccEdPoint {
+    fe25519 X, Y, Z, T;
+};
+
+//Affine table entry: y+x, y-x, 2dxy
+struct EccEdPrecomp {
+    fe25519 yplusx, yminusx, xy2d;
+};
+
+struct EccBaseTable {
+    EccEdPrecomp entry[32][8];//entry[i][j] = (j+1) * 256^i * B
+    EccEdPrecomp top;//2^256 * B, for the carry out of a full 256 bit scalar
+};
+
+//x coordinate of the Ed25519 base point, whose y = 4/5 maps to u = 9
+static const unsigned char ecc_ed_basex[32] = {
+    0x21,0x69,0x36,0xd3,0xcd,0x6e,0x53,0xfe,0xc0,0xa4,0xe2,0x31,0xfd,0xd6,0xdc,0x5c,
+    0x69,0x2c,0xc7,0x60,0x95,0x25,0xa7,0xb2,0xc9,0x56,0x2d,0x60,0x8f,0x25,0xd5,0x1a
+};
+
+static void ecc_ed_identity(EccEdPoint &h)
+{
+    fe_0(h.X);
+    fe_1(h.Y);
+    fe_1(h.Z);
+    fe_0(h.T);
+}
 
-    T0 = T2 * T0;
-    mpz_mod(T0.get_mpz_t(),T0.get_mpz_t(),ECC_Prime.get_mpz_t());
+//h = p + q, or p - q when neg is set. Unified formula, also valid for q = p.
+static void ecc_ed_madd(EccEdPoint &h, const EccEdPoint &p, const EccEdPrecomp &q, bool neg)
+{
+    fe25519 A, B, C, D, E, F, G, H, t;
+
+    fe_sub(t,p.Y,p.X);
+    fe_mul(A,t,neg ? q.yplusx : q.yminusx);
+    fe_add(t,p.Y,p.X);
+    fe_mul(B,t,neg ? q.yminusx : q.yplusx);
+    fe_mul(C,p.T,q.xy2d);
+    fe_add(D,p.Z,p.Z);
+
+    fe_sub(E,B,A);
+    fe_add(H,B,A);
+    if(neg){
+        fe_add(F,D,C);
+        fe_sub(G,D,C);
+    }
+    else{
+        fe_sub(F,D,C);
+        fe_add(G,D,C);
+    }
 
-    T2 = T4 - T3;
-    mpz_mod(T2.get_mpz_t(),T2.get_mpz_t(),ECC_Prime.get_mpz_t());
+    fe_mul(h.X,E,F);
+    fe_mul(h.Y,G,H);
+    fe_mul(h.T,E,H);
+    fe_mul(h.Z,F,G);
+}
 
-    T4 = a24 * T2;
-    mpz_mod(T4.get_mpz_t(),T4.get_mpz_t(),ECC_Prime.get_mpz_t());
+static void ecc_ed_dbl(EccEdPoint &h, const EccEdPoint &p)
+{
+    fe25519 XX, YY, B, AA, E, F, G, H, t;
+
+    fe_sq(XX,p.X);
+    fe_sq(YY,p.Y);
+    fe_sq(t,p.Z);
+    fe_add(B,t,t);
+    fe_add(t,p.X,p.Y);
+    fe_sq(AA,t);
+
+    fe_add(H,YY,XX);
+    fe_sub(G,YY,XX);
+    fe_sub(E,AA,H);
+    //F = 2Z^2 - G, kept below 2^54 per limb by a carry pass
+    fe_add(t,B,XX);
+    fe_sub(F,t,YY);
+    fe_carry(F,F.v[0],F.v[1],F.v[2],F.v[3],F.v[4]);
+
+    fe_mul(h.X,E,F);
+    fe_mul(h.Y,H,G);
+    fe_mul(h.T,E,H);
+    fe_mul(h.Z,G,F);
+}
 
-    T5 = T0 + T1;
-    mpz_mod(T5.get_mpz_t(),T5.get_mpz_t(),ECC_Prime.get_mpz_t());
+static void ecc_ed_toprecomp(EccEdPrecomp &h, const EccEdPoint &p, const fe25519 &d2)
+{
+    fe25519 zinv, x, y, xy;
+
+    fe_invert(zinv,p.Z);
+    fe_mul(x,p.X,zinv);
+    fe_mul(y,p.Y,zinv);
+    fe_add(h.yplusx,y,x);
+    fe_sub(h.yminusx,y,x);
+    fe_mul(xy,x,y);
+    fe_mul(h.xy2d,xy,d2);
+}
 
-    T0 = T0 - T1;
-    mpz_mod(T0.get_mpz_t(),T0.get_mpz_t(),ECC_Prime.get_mpz_t());
+static EccBaseTable *ecc_build_base_table()
+{
+    EccBaseTable *table = new EccBaseTable;
+    fe25519 zero, t, d, d2;
+    EccEdPoint base, p;
+    EccEdPrecomp base_pre;
+
+    //d = -121665/121666
+    fe_0(zero);
+    fe_0(t);
+    t.v[0] = 121666;
+    fe_invert(d,t);
+    fe_mul_small(d,d,121665);
+    fe_sub(d,zero,d);
+    fe_carry(d,d.v[0],d.v[1],d.v[2],d.v[3],d.v[4]);
+    fe_add(d2,d,d);
+
+    //B = (x, 4/5)
+    fe_0(t);
+    t.v[0] = 5;
+    fe_invert(base.Y,t);
+    fe_mul_small(base.Y,base.Y,4);
+    fe_frombytes(base.X,ecc_ed_basex);
+    fe_1(base.Z);
+    fe_mul(base.T,base.X,base.Y);
+
+    for(int i=0;i<32;++i){
+        ecc_ed_toprecomp(base_pre,base,d2);
+        p = base;
+        for(int j=0;j<8;++j){
+            ecc_ed_toprecomp(table->entry[i][j],p,d2);
+            ecc_ed_madd(p,p,base_pre,false);
+        }
+        for(int k=0;k<8;++k) ecc_ed_dbl(base,base);
+    }
+    ecc_ed_toprecomp(table->top,base,d2);
 
-    P5x = T5 * T5;
-    mpz_mod(P5x.get_mpz_t(),P5x.get_mpz_t(),ECC_Prime.get_mpz_t());
+    return table;
+}
 
-    T0 = T0 * T0;
-    mpz_mod(T0.get_mpz_t(),T0.get_mpz_t(),ECC_Prime.get_mpz_t());
+//Built on first use, the servers never need it
+static const EccBaseTable &ecc_base_table()
+{
+    static const EccBaseTable *table = ecc_build_base_table();
+    return *table;
+}
 
-    T4 = T3 + T4;
-    mpz_mod(T4.get_mpz_t(),T4.get_mpz_t(),ECC_Prime.get_mpz_t());
+static void ecc_ed_scalarmul_base(EccEdPoint &h, const unsigned char *scalar){
 
-    P4z = T2 * T4;
-    mpz_mod(P4z.get_mpz_t(),P4z.get_mpz_t(),ECC_Prime.get_mpz_t());
+    const EccBaseTable &table = ecc_base_table();
+    signed char e[65];
 
-    P5z = X1 * T0;
-    mpz_mod(P5z.get_mpz_t(),P5z.get_mpz_t(),ECC_Prime.get_mpz_t());
+    //Radix-16 digits of the little-endian scalar, recoded into [-8,8) with a final carry
+    for(int i=0;i<32;++i){
+        e[(2*i)] = scalar[31-i] & 15;
+        e[(2*i)+1] = (scalar[31-i] >> 4) & 15;
+    }
+    signed char carry = 0;
+    for(int i=0;i<64;++i){
+        e[i] += carry;
+        carry = (e[i] + 8) >> 4;
+        e[i] -= carry << 4;
+    }
+    e[64] = carry;
 
-    return 0;
+    //Odd positions first, shifted by one digit, then the even ones
+    ecc_ed_identity(h);
+    for(int i=1;i<64;i+=2){
+        if(e[i] > 0) ecc_ed_madd(h,h,table.entry[i/2][e[i]-1],false);
+        else if(e[i] < 0) ecc_ed_madd(h,h,table.entry[i/2][-e[i]-1],true);
+    }
+    for(int k=0;k<4;++k) ecc_ed_dbl(h,h);
+    for(int i=0;i<64;i+=2){
+        if(e[i] > 0) ecc_ed_madd(h,h,table.entry[i/2][e[i]-1],false);
+        else if(e[i] < 0) ecc_ed_madd(h,h,table.entry[i/2][-e[i]-1],true);
+    }
+    if(e[64]) ecc_ed_madd(h,h,table.top,false);
 }
 
-int ScalarMul(unsigned char *product, unsigned char *scalar, unsigned char *basep){
+int ScalarMulBase(unsigned char *product, unsigned char *scalar){
 
-    mpz_class prod;
-    mpz_class sca;
-    mpz_class base;
+    EccEdPoint h;
+    fe25519 num, den, dinv, u;
 
-    mpz_import(sca.get_mpz_t(),32,1,1,0,0,scalar);
-    mpz_import(base.get_mpz_t(),32,1,1,0,0,basep);
+    ecc_ed_scalarmul_base(h,scalar);
 
-    size_t scalen = mpz_sizeinbase(sca.get_mpz_t(),2)-1;
-    mpz_class pc = base;
-    mpz_class p1x = base;
-    mpz_class p1z("1",10);
-    mpz_class p2x("1",10);
-    mpz_class p2z("0",10);
+    //u = (Z+Y)/(Z-Y); the identity has Z = Y and gives 0 like the ladder
+    fe_add(num,h.Z,h.Y);
+    fe_sub(den,h.Z,h.Y);
+    fe_invert(dinv,den);
+    fe_mul(u,num,dinv);
+    fe_tobytes(product,u);
 
-    mpz_class p3x;
-    mpz_class p3z;
-    mpz_class p4x;
-    mpz_class p4z;
+    return 0;
+}
 
-    while(scalen > 0){
-        if(mpz_tstbit(sca.get_mpz_t(),scalen)) DoubleAndAdd(p1x,p1z,p2x,p2z,p1x,p1z,p2x,p2z,pc);
-        else DoubleAndAdd(p2x,p2z,p1x,p1z,p2x,p2z,p1x,p1z,pc);
-        scalen--;
+int ScalarMulBase_N(unsigned char *product, unsigned char *scalar, unsigned int n){
+
+    std::vector<fe25519> num(n), den(n), prefix(n);
+    EccEdPoint h;
+    fe25519 acc, inv, u, t;
+    unsigned char acc_bytes[32];
+    static const unsigned char zero_bytes[32] = {0};
+
+    fe_1(acc);
+    for(unsigned int i=0;i<n;++i){
+        ecc_ed_scalarmul_base(h,scalar+(32*i));
+        fe_add(num[i],h.Z,h.Y);
+        fe_sub(den[i],h.Z,h.Y);
+        fe_carry(den[i],den[i].v[0],den[i].v[1],den[i].v[2],den[i].v[3],den[i].v[4]);
+        prefix[i] = acc;
+        fe_mul(acc,acc,den[i]);
     }
 
-    if(mpz_tstbit(sca.get_mpz_t(),0)) DoubleAndAdd(p1x,p1z,p2x,p2z,p1x,p1z,p2x,p2z,pc);
-    else DoubleAndAdd(p2x,p2z,p1x,p1z,p2x,p2z,p1x,p1z,pc);
-
-    mpz_powm(p2z.get_mpz_t(),p2z.get_mpz_t(),ECC_InvExp.get_mpz_t(),ECC_Prime.get_mpz_t());
-    p2x = p2x * p2z;
-    mpz_mod(prod.get_mpz_t(),p2x.get_mpz_t(),ECC_Prime.get_mpz_t());
-
-    std::string prodstr = prod.get_str(16);
+    //A scalar that is a multiple of the group order zeroes the whole product
+    fe_tobytes(acc_bytes,acc);
+    if(::memcmp(acc_bytes,zero_bytes,32) == 0){
+        for(unsigned int i=0;i<n;++i){
+            fe_invert(inv,den[i]);
+            fe_mul(u,num[i],inv);
+            fe_tobytes(product+(32*i),u);
+        }
+        return 0;
+    }
 
-    std::string dest = std::string( 64-prodstr.length(), '0').append(prodstr);
-    const char *text = dest.data();
-    char temp[2];
-    for (int j=0; j<32; j++)
-    {
-        temp[0] = text[2*j];
-        temp[1] = text[2*j+1];
-        product[j] = ::strtoul(temp,nullptr,16) & 0xFF;
+    //One inversion for the chunk, peeled off back to front
+    fe_invert(inv,acc);
+    for(unsigned int i=n;i-->0;){
+        fe_mul(t,inv,prefix[i]);
+        fe_mul(inv,inv,den[i]);
+        fe_mul(u,num[i],t);
+        fe_tobytes(product+(32*i),u);
     }
 
     return 0;
@@ -4,14 +4,17 @@
 #include <iostream>
 #include <cstring>
 #include <string>
-#include <gmpxx.h>
+#include <vector>
 
-using namespace std;
+#include "fe25519.h"
 
-extern mpz_class ECC_Prime;
-extern mpz_class ECC_InvExp;
+using namespace std;
 
-int DoubleAndAdd(mpz_class &P4x,mpz_class &P4z,mpz_class &P5x,mpz_class &P5z, mpz_class P2x,mpz_class P2z,mpz_class P3x,mpz_class P3z,mpz_class X1);
+int DoubleAndAdd(fe25519 &P4x,fe25519 &P4z,fe25519 &P5x,fe25519 &P5z, const fe25519 &P2x,const fe25519 &P2z,const fe25519 &P3x,const fe25519 &P3z,const fe25519 &X1);
 int ScalarMul(unsigned char *product, unsigned char *scalar, unsigned char *basep);
+//ScalarMul with the fixed base point u = 9 (ecc_basep), from a precomputed table
+int ScalarMulBase(unsigned char *product, unsigned char *scalar);
+//ScalarMulBase over n scalars, sharing one field inversion
+int ScalarMulBase_N(unsigned char *product, unsigned char *scalar, unsigned int n);
 
 #endif // ECC_X25519_H
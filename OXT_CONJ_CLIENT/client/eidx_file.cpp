@@ -0,0 +1,215 @@
+#include "eidx_file.h"
+
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int EIdx_WriteAll(int fd, const unsigned char *data, size_t len)
+{
+    while(len > 0){
+        ssize_t n = ::write(fd,data,len);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int EIdx_WriterFlush(EIdxWriter *w)
+{
+    if(w->buf.empty()) return 0;
+    if(EIdx_WriteAll(w->fd,w->buf.data(),w->buf.size()) < 0) return -1;
+    w->buf.clear();
+    return 0;
+}
+
+static int EIdx_WriteHeader(EIdxWriter *w)
+{
+    unsigned char header_block[EIDX_FILE_HEADER_SIZE];
+    ::memset(header_block,0x00,EIDX_FILE_HEADER_SIZE);
+    ::memcpy(header_block,&w->header,sizeof(EIdxFileHeader));
+
+    if(::pwrite(w->fd,header_block,EIDX_FILE_HEADER_SIZE,0) != EIDX_FILE_HEADER_SIZE) return -1;
+    return 0;
+}
+
+int EIdx_WriterOpen(EIdxWriter *w, const std::string &eidx_file)
+{
+    w->fd = ::open(eidx_file.data(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if(w->fd < 0){
+        std::cout << "Could not open " << eidx_file << " for writing" << std::endl;
+        return -1;
+    }
+
+    ::memset(&w->header,0x00,sizeof(EIdxFileHeader));
+    ::memcpy(w->header.magic,EIDX_FILE_MAGIC,8);
+    w->header.version = EIDX_FILE_VERSION;
+    w->header.complete = 0;
+
+    w->buf.clear();
+    w->buf.reserve(EIDX_WRITE_BUFFER);
+
+    //Placeholder until close, records start right after it
+    if(EIdx_WriteHeader(w) < 0 || ::lseek(w->fd,EIDX_FILE_HEADER_SIZE,SEEK_SET) < 0){
+        std::cout << "Could not write " << eidx_file << std::endl;
+        ::close(w->fd);
+        w->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int EIdx_WriterAppend(EIdxWriter *w, const unsigned char *kw, const unsigned char *yid, const unsigned char *ec, uint32_t n_ids)
+{
+    size_t rec_len = EIDX_RECORD_HEADER_SIZE + ((size_t)EIDX_ENTRY_LEN * n_ids);
+
+    if(w->buf.size() + rec_len > EIDX_WRITE_BUFFER && EIdx_WriterFlush(w) < 0) return -1;
+
+    size_t pos = w->buf.size();
+    w->buf.resize(pos + rec_len);
+    unsigned char *rec = w->buf.data() + pos;
+
+    uint32_t reserved = 0;
+    ::memcpy(rec,kw,16);
+    ::memcpy(rec+16,&n_ids,4);
+    ::memcpy(rec+20,&reserved,4);
+
+    unsigned char *entry = rec + EIDX_RECORD_HEADER_SIZE;
+    for(uint32_t i=0;i<n_ids;++i){
+        ::memcpy(entry,yid+(32*i),32);
+        ::memcpy(entry+32,ec+(16*i),16);
+        entry += EIDX_ENTRY_LEN;
+    }
+
+    w->header.n_rows++;
+    w->header.n_entries += n_ids;
+    w->header.data_len += rec_len;
+
+    //A single oversized row goes straight out
+    if(w->buf.size() >= EIDX_WRITE_BUFFER) return EIdx_WriterFlush(w);
+
+    return 0;
+}
+
+int EIdx_WriterClose(EIdxWriter *w)
+{
+    int ret = 0;
+
+    if(EIdx_WriterFlush(w) < 0) ret = -1;
+
+    if(ret == 0){
+        w->header.complete = 1;
+        if(EIdx_WriteHeader(w) < 0) ret = -1;
+    }
+
+    if(::close(w->fd) < 0) ret = -1;
+    w->fd = -1;
+    w->buf.clear();
+    w->buf.shrink_to_fit();
+
+    if(ret < 0) std::cout << "Could not finish writing the encrypted index" << std::endl;
+    return ret;
+}
+
+int EIdx_ReaderOpen(EIdxReader *r, const std::string &eidx_file)
+{
+    r->map = nullptr;
+    r->map_len = 0;
+    r->offset = EIDX_FILE_HEADER_SIZE;
+    r->row = 0;
+
+    int fd = ::open(eidx_file.data(),O_RDONLY);
+    if(fd < 0){
+        std::cout << "Could not open " << eidx_file << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if(::fstat(fd,&st) < 0 || (size_t)st.st_size < EIDX_FILE_HEADER_SIZE){
+        std::cout << "Encrypted index " << eidx_file << " has unexpected size" << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    size_t file_len = st.st_size;
+    void *map = ::mmap(nullptr,file_len,PROT_READ,MAP_PRIVATE,fd,0);
+    ::close(fd);
+    if(map == MAP_FAILED){
+        std::cout << "Could not map " << eidx_file << std::endl;
+        return -1;
+    }
+
+    ::memcpy(&r->header,map,sizeof(EIdxFileHeader));
+
+    if(::memcmp(r->header.magic,EIDX_FILE_MAGIC,8) != 0 || r->header.version != EIDX_FILE_VERSION ||
+       r->header.complete != 1 || r->header.data_len != file_len - EIDX_FILE_HEADER_SIZE){
+        std::cout << "Encrypted index " << eidx_file << " is not a complete index file" << std::endl;
+        ::munmap(map,file_len);
+        return -1;
+    }
+
+    r->map = static_cast<unsigned char*>(map);
+    r->map_len = file_len;
+    r->max_row_ids = 0;
+
+    //Walk the record headers once so that a consumer can size its buffers and never
+    //meets a bad record halfway through
+    const unsigned char *kw, *entries;
+    uint32_t n_ids;
+    uint64_t n_entries = 0;
+    int ret;
+    while((ret = EIdx_ReaderNext(r,&kw,&entries,&n_ids)) == 1){
+        n_entries += n_ids;
+        if(n_ids > r->max_row_ids) r->max_row_ids = n_ids;
+    }
+    if(ret < 0 || n_entries != r->header.n_entries){
+        std::cout << "Encrypted index " << eidx_file << " has malformed records" << std::endl;
+        EIdx_ReaderClose(r);
+        return -1;
+    }
+    r->offset = EIDX_FILE_HEADER_SIZE;
+    r->row = 0;
+
+    ::madvise(map,file_len,MADV_SEQUENTIAL);
+
+    return 0;
+}
+
+int EIdx_ReaderNext(EIdxReader *r, const unsigned char **kw, const unsigned char **entries, uint32_t *n_ids)
+{
+    if(r->row == r->header.n_rows) return (r->offset == r->map_len) ? 0 : -1;
+    if(r->map_len - r->offset < EIDX_RECORD_HEADER_SIZE) return -1;
+
+    const unsigned char *rec = r->map + r->offset;
+    uint32_t n;
+    ::memcpy(&n,rec+16,4);
+
+    size_t rec_len = EIDX_RECORD_HEADER_SIZE + ((size_t)EIDX_ENTRY_LEN * n);
+    if(r->map_len - r->offset < rec_len) return -1;
+
+    *kw = rec;
+    *entries = rec + EIDX_RECORD_HEADER_SIZE;
+    *n_ids = n;
+
+    r->offset += rec_len;
+    r->row++;
+
+    return 1;
+}
+
+int EIdx_ReaderClose(EIdxReader *r)
+{
+    if(r->map != nullptr) ::munmap(r->map,r->map_len);
+    r->map = nullptr;
+    r->map_len = 0;
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef EIDX_FILE_H
+#define EIDX_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//Encrypted index handed from EDB_SetUp to TSet_SetUp. A 64 byte header followed by
+//one record per keyword:
+//  keyword(16) || n_ids(4) || reserved(4) || n_ids entries of y(32) || e(16)
+//The header is only marked complete when the writer is closed, so a finished file
+//doubles as a checkpoint of the ECC part of setup.
+#define EIDX_FILE_MAGIC "OXTEIDX "
+#define EIDX_FILE_VERSION 1
+#define EIDX_FILE_HEADER_SIZE 64
+#define EIDX_RECORD_HEADER_SIZE 24
+#define EIDX_ENTRY_LEN 48
+//Bytes buffered by the writer before a write(2)
+#define EIDX_WRITE_BUFFER (1 << 20)
+
+struct EIdxFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t complete;
+    uint64_t n_rows;
+    uint64_t n_entries;
+    uint64_t data_len;//bytes of records after the header
+};
+
+struct EIdxWriter {
+    int fd;
+    EIdxFileHeader header;
+    std::vector<unsigned char> buf;
+};
+
+struct EIdxReader {
+    unsigned char *map;
+    size_t map_len;
+    size_t offset;
+    uint64_t row;
+    uint32_t max_row_ids;
+    EIdxFileHeader header;
+};
+
+int EIdx_WriterOpen(EIdxWriter *w, const std::string &eidx_file);
+//Appends one keyword row, yid and ec are the 32 and 16 byte strided setup arrays
+int EIdx_WriterAppend(EIdxWriter *w, const unsigned char *kw, const unsigned char *yid, const unsigned char *ec, uint32_t n_ids);
+int EIdx_WriterClose(EIdxWriter *w);
+
+//Maps a complete file read-only and checks every record header. Rows are then walked
+//in order with EIdx_ReaderNext, which points kw and entries into the mapping and
+//returns 1 per row, 0 at the end, -1 on a malformed record.
+int EIdx_ReaderOpen(EIdxReader *r, const std::string &eidx_file);
+int EIdx_ReaderNext(EIdxReader *r, const unsigned char **kw, const unsigned char **entries, uint32_t *n_ids);
+int EIdx_ReaderClose(EIdxReader *r);
+
+#endif // EIDX_FILE_H
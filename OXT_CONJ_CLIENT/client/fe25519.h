@@ -0,0 +1,105 @@
+#ifndef FE25519_H
+#define FE25519_H
+
+#include <cstdint>
+
+//Element of GF(2^255-19) in radix 2^51: value = v[0] + v[1]*2^51 + ... + v[4]*2^204
+//Limbs are kept below 2^54 between operations, reduction is only done in fe_tobytes
+struct fe25519 {
+    uint64_t v[5];
+};
+
+typedef unsigned __int128 fe_uint128;
+
+#define FE_MASK51 0x7FFFFFFFFFFFFULL
+
+//Big-endian 32 byte encoding, as used by the rest of the ECC code
+int fe_frombytes(fe25519 &h, const unsigned char *s);
+int fe_tobytes(unsigned char *s, const fe25519 &h);
+int fe_invert(fe25519 &out, const fe25519 &z);
+
+static inline void fe_0(fe25519 &h)
+{
+    h.v[0] = 0; h.v[1] = 0; h.v[2] = 0; h.v[3] = 0; h.v[4] = 0;
+}
+
+static inline void fe_1(fe25519 &h)
+{
+    h.v[0] = 1; h.v[1] = 0; h.v[2] = 0; h.v[3] = 0; h.v[4] = 0;
+}
+
+static inline void fe_add(fe25519 &h, const fe25519 &f, const fe25519 &g)
+{
+    for(int i=0;i<5;++i) h.v[i] = f.v[i] + g.v[i];
+}
+
+//h = f - g + 4p, limbs of g must be below 2^53
+static inline void fe_sub(fe25519 &h, const fe25519 &f, const fe25519 &g)
+{
+    h.v[0] = (f.v[0] + 0x1FFFFFFFFFFFB4ULL) - g.v[0];
+    h.v[1] = (f.v[1] + 0x1FFFFFFFFFFFFCULL) - g.v[1];
+    h.v[2] = (f.v[2] + 0x1FFFFFFFFFFFFCULL) - g.v[2];
+    h.v[3] = (f.v[3] + 0x1FFFFFFFFFFFFCULL) - g.v[3];
+    h.v[4] = (f.v[4] + 0x1FFFFFFFFFFFFCULL) - g.v[4];
+}
+
+static inline void fe_carry(fe25519 &h, fe_uint128 t0, fe_uint128 t1, fe_uint128 t2, fe_uint128 t3, fe_uint128 t4)
+{
+    uint64_t r0, r1, r2, r3, r4;
+
+    r0 = (uint64_t)t0 & FE_MASK51; t1 += (uint64_t)(t0 >> 51);
+    r1 = (uint64_t)t1 & FE_MASK51; t2 += (uint64_t)(t1 >> 51);
+    r2 = (uint64_t)t2 & FE_MASK51; t3 += (uint64_t)(t2 >> 51);
+    r3 = (uint64_t)t3 & FE_MASK51; t4 += (uint64_t)(t3 >> 51);
+    r4 = (uint64_t)t4 & FE_MASK51;
+
+    //Top carry can exceed 2^59, fold it back with 19*c in 128 bits
+    t0 = (fe_uint128)r0 + (t4 >> 51) * 19;
+    r0 = (uint64_t)t0 & FE_MASK51;
+    r1 += (uint64_t)(t0 >> 51);
+
+    h.v[0] = r0; h.v[1] = r1; h.v[2] = r2; h.v[3] = r3; h.v[4] = r4;
+}
+
+static inline void fe_mul(fe25519 &h, const fe25519 &f, const fe25519 &g)
+{
+    const uint64_t f0 = f.v[0], f1 = f.v[1], f2 = f.v[2], f3 = f.v[3], f4 = f.v[4];
+    const uint64_t g0 = g.v[0], g1 = g.v[1], g2 = g.v[2], g3 = g.v[3], g4 = g.v[4];
+    const uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+
+    fe_uint128 t0 = (fe_uint128)f0*g0 + (fe_uint128)f1*g4_19 + (fe_uint128)f2*g3_19 + (fe_uint128)f3*g2_19 + (fe_uint128)f4*g1_19;
+    fe_uint128 t1 = (fe_uint128)f0*g1 + (fe_uint128)f1*g0 + (fe_uint128)f2*g4_19 + (fe_uint128)f3*g3_19 + (fe_uint128)f4*g2_19;
+    fe_uint128 t2 = (fe_uint128)f0*g2 + (fe_uint128)f1*g1 + (fe_uint128)f2*g0 + (fe_uint128)f3*g4_19 + (fe_uint128)f4*g3_19;
+    fe_uint128 t3 = (fe_uint128)f0*g3 + (fe_uint128)f1*g2 + (fe_uint128)f2*g1 + (fe_uint128)f3*g0 + (fe_uint128)f4*g4_19;
+    fe_uint128 t4 = (fe_uint128)f0*g4 + (fe_uint128)f1*g3 + (fe_uint128)f2*g2 + (fe_uint128)f3*g1 + (fe_uint128)f4*g0;
+
+    fe_carry(h,t0,t1,t2,t3,t4);
+}
+
+static inline void fe_sq(fe25519 &h, const fe25519 &f)
+{
+    const uint64_t f0 = f.v[0], f1 = f.v[1], f2 = f.v[2], f3 = f.v[3], f4 = f.v[4];
+    const uint64_t f0_2 = 2 * f0, f1_2 = 2 * f1;
+    const uint64_t f1_38 = 38 * f1, f2_38 = 38 * f2, f3_38 = 38 * f3;
+    const uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4;
+
+    fe_uint128 t0 = (fe_uint128)f0*f0 + (fe_uint128)f1_38*f4 + (fe_uint128)f2_38*f3;
+    fe_uint128 t1 = (fe_uint128)f0_2*f1 + (fe_uint128)f2_38*f4 + (fe_uint128)f3_19*f3;
+    fe_uint128 t2 = (fe_uint128)f0_2*f2 + (fe_uint128)f1*f1 + (fe_uint128)f3_38*f4;
+    fe_uint128 t3 = (fe_uint128)f0_2*f3 + (fe_uint128)f1_2*f2 + (fe_uint128)f4_19*f4;
+    fe_uint128 t4 = (fe_uint128)f0_2*f4 + (fe_uint128)f1_2*f3 + (fe_uint128)f2*f2;
+
+    fe_carry(h,t0,t1,t2,t3,t4);
+}
+
+static inline void fe_mul_small(fe25519 &h, const fe25519 &f, uint32_t n)
+{
+    fe_carry(h,
+             (fe_uint128)f.v[0]*n,
+             (fe_uint128)f.v[1]*n,
+             (fe_uint128)f.v[2]*n,
+             (fe_uint128)f.v[3]*n,
+             (fe_uint128)f.v[4]*n);
+}
+
+#endif // FE25519_H
@@ -38,6 +38,48 @@ ssize_t send_all(int sockfd, unsigned char* buffer, size_t length) {
     return total_sent;
 }
 
+//Header and payload go out in one write, see search_protocol.h
+int Msg_Send(int sockfd, uint8_t type, uint32_t request_id, const unsigned char *payload, uint64_t length)
+{
+    std::vector<unsigned char> msg;
+    MsgHeader hdr;
+
+    MsgHeader_Set(&hdr,type,request_id,length);
+    msg.reserve(sizeof(MsgHeader)+length);
+    msg.insert(msg.end(),(const unsigned char*)&hdr,(const unsigned char*)&hdr+sizeof(MsgHeader));
+    if(length > 0){
+        msg.insert(msg.end(),payload,payload+length);
+    }
+
+    return (send_all(sockfd,msg.data(),msg.size()) == (ssize_t)msg.size()) ? 0 : -1;
+}
+
+//Header only, the length bytes of payload are then written with send_all in any split
+int Msg_SendHeader(int sockfd, uint8_t type, uint32_t request_id, uint64_t length)
+{
+    MsgHeader hdr;
+    MsgHeader_Set(&hdr,type,request_id,length);
+    return (send_all(sockfd,(unsigned char*)&hdr,sizeof(MsgHeader)) == (ssize_t)sizeof(MsgHeader)) ? 0 : -1;
+}
+
+//Fails without reading the payload if the version is unknown or the payload is above max_len
+int Msg_Recv(int sockfd, MsgHeader *hdr, std::vector<unsigned char> &payload, uint64_t max_len)
+{
+    if(recv_all(sockfd,(unsigned char*)hdr,sizeof(MsgHeader)) != sizeof(MsgHeader)){
+        return -1;
+    }
+    if(hdr->version != SEARCH_PROTO_VERSION || hdr->length > max_len){
+        return -1;
+    }
+
+    payload.resize(hdr->length);
+    if(hdr->length > 0 && recv_all(sockfd,payload.data(),hdr->length) != (ssize_t)hdr->length){
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * Sends a file over a TCP socket
  * @param sockfd The socket file descriptor
@@ -150,12 +192,12 @@ void printMemoryNibbles(const void* address, size_t k) {
 
 int Sys_Init()
 {
-    connection_options.host = "127.0.0.1";  // Required.
-    pool_options.size = N_threads;  // Pool size, i.e. max number of connections.
-
     BloomFilter_Init(BF);
     SetUpThreads();
 
+    std::cout << "AES kernel: " << AES_KernelName() << std::endl;
+    std::cout << "BLAKE3 kernel: " << Blake3_KernelName() << std::endl;
+
     return 0;
 }
 
@@ -170,638 +212,221 @@ int Sys_Clear()
 
 int SetUpThreads()
 {
-    GL_AES_PT = new unsigned char[N_threads*16];
-    GL_AES_KT = new unsigned char[16];
-    GL_AES_CT = new unsigned char[N_threads*16];
-    GL_ECC_INVA = new unsigned char[N_threads*32];
-    GL_ECC_INVP = new unsigned char[N_threads*32];
-    GL_ECC_SCA = new unsigned char[N_threads*32];
-    GL_ECC_BP = new unsigned char[N_threads*32];
-    GL_ECC_SMP = new unsigned char[N_threads*32];
-    GL_ECC_INB = new unsigned char[N_threads*32];
-    GL_ECC_INA = new unsigned char[N_threads*32];
-    GL_ECC_PRD = new unsigned char[N_threads*32];
-    GL_HASH_MSG = new unsigned char[N_threads*16];
-    GL_HASH_DGST = new unsigned char[N_threads*64];
-    GL_BLM_MSG = new unsigned char[N_threads*40];
-    GL_BLM_DGST = new unsigned char[N_threads*64];
-
-    GL_MGDB_RES = new unsigned char[N_threads*49];
-    GL_MGDB_BIDX = new unsigned char[N_threads*2];
-    GL_MGDB_JIDX = new unsigned char[N_threads*2];
-    GL_MGDB_LBL = new unsigned char[N_threads*12];
-
-    GL_OPCODE = new unsigned int;
-
-    ready = false;
-    processed = false;
-
-    nWorkerCount = N_threads;
-    nCurrentIteration = 0;
-
-    thread_pool.clear();
-    for(unsigned int i=0;i<N_threads;++i){
-        thread_pool.push_back(thread(
-          WorkerThread,
-          GL_AES_PT+(i*16),
-          GL_AES_KT,
-          GL_AES_CT+(i*16),
-          GL_ECC_INVA+(i*32),
-          GL_ECC_INVP+(i*32),
-          GL_ECC_SCA+(i*32),
-          GL_ECC_BP+(i*32),
-          GL_ECC_SMP+(i*32),
-          GL_ECC_INB+(i*32),
-          GL_ECC_INA+(i*32),
-          GL_ECC_PRD+(i*32),
-          GL_HASH_MSG+(i*16),
-          GL_HASH_DGST+(i*64),
-          GL_BLM_MSG+(i*40),
-          GL_BLM_DGST+(i*64),
-          GL_MGDB_RES+(i*49),
-          GL_MGDB_BIDX+(i*2),
-          GL_MGDB_JIDX+(i*2),
-          GL_MGDB_LBL+(i*12),
-          GL_OPCODE
-        ));
-    }
-
-    int rc = 0;
-    for(unsigned int i=0;i<N_threads;++i){
-          cpu_set_t cpuset;
-          CPU_ZERO(&cpuset);
-          CPU_SET(i, &cpuset);
-          rc = pthread_setaffinity_np(thread_pool[i].native_handle(), sizeof(cpu_set_t), &cpuset);
-          if (rc != 0) {
-              std::cout << "Error calling pthread_setaffinity_np: " << rc << std::endl;
-          }
-    }
-
+    TaskEngine_Init(N_threads);
     return 0;
 }
 
 int ReleaseThreads()
 {
+    TaskEngine_Release();
+    return 0;
+}
 
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        nWorkerCount = N_threads;
-        processed = true;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
+//Ids [id_begin,id_end) of one row, a single task of the setup. xind = PRF(KI,id) is
+//computed once per id and feeds both the encrypted index entry (y = xind * z^-1, e),
+//written to YID/EC at the id's position, and the xtag g^(kxw * xind), which is
+//inserted into the Bloom filter directly.
+static int EDB_SetUpTask(const WIdxDB *db, uint32_t row, uint32_t id_begin, uint32_t id_end, unsigned char *YID, unsigned char *EC)
+{
+    unsigned char W[16];
+    unsigned char KE[16];
+    unsigned char kxw[16];
+    unsigned char ID[16*EDB_TASK_IDS];
+    unsigned char XID[16*EDB_TASK_IDS];
+    unsigned char WC[16*EDB_TASK_IDS];
+    unsigned char ZW[16*EDB_TASK_IDS];
+    unsigned char ZWP[32*EDB_TASK_IDS];
+    unsigned char ZWI[32*EDB_TASK_IDS];
+    unsigned char XIDA[32*EDB_TASK_IDS];
+    unsigned char kxw_arr[32*EDB_TASK_IDS];
+    unsigned char xid_kwx[32*EDB_TASK_IDS];
+    unsigned char gfp_kwx[32*EDB_TASK_IDS];
+    unsigned char blm_msg[40*N_HASH];
+    unsigned char bhash[64*N_HASH];
+    unsigned int bf_indices[N_HASH];
 
-    {
-      std::unique_lock<std::mutex> lock(mrun);
-      workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
+    uint32_t n = id_end - id_begin;
+    const unsigned char *ids = WIdx_RowIdData(db,row) + (WIDX_ID_LEN*id_begin);
 
-    for(std::thread &every_thread : thread_pool){
-        every_thread.join();
+    ::memset(W,0x00,16);
+    ::memset(ID,0x00,16*n);
+    ::memset(ZWP,0x00,32*n);
+    ::memset(XIDA,0x00,32*n);
+    ::memset(kxw_arr,0x00,32*n);
+    ::memset(blm_msg,0x00,40*N_HASH);
+    ::memset(bhash,0x00,64*N_HASH);
+
+    ::memcpy(W,WIdx_RowKeyword(db,row),WIDX_KW_LEN);
+    for(uint32_t i=0;i<n;++i){
+        ::memcpy(ID+(16*i),ids+(WIDX_ID_LEN*i),WIDX_ID_LEN);
     }
 
-    thread_pool.clear();
-
-    delete [] GL_AES_PT;
-    delete [] GL_AES_KT;
-    delete [] GL_AES_CT;
-    delete [] GL_ECC_INVA;
-    delete [] GL_ECC_INVP;
-    delete [] GL_ECC_SCA;
-    delete [] GL_ECC_BP;
-    delete [] GL_ECC_SMP;
-    delete [] GL_ECC_INB;
-    delete [] GL_ECC_INA;
-    delete [] GL_ECC_PRD;
-    delete [] GL_HASH_MSG;
-    delete [] GL_HASH_DGST;
-    delete [] GL_BLM_MSG;
-    delete [] GL_BLM_DGST;
-
-    delete [] GL_MGDB_RES;
-    delete [] GL_MGDB_BIDX;
-    delete [] GL_MGDB_JIDX;
-    delete [] GL_MGDB_LBL;
-
-    delete GL_OPCODE;
+    AESENC(KE,W,KS);//Generate KE from W and KS
+    AESENC(kxw,W,KX);//Generate kxw from W and KX
 
-    return 0;
-}
+    AESKeySchedule ks_i, ks_z, ks_e;
+    AES_LoadKeyEncOnly(&ks_i,KI);
+    AES_LoadKeyEncOnly(&ks_z,KZ);
+    AES_LoadKeyEncOnly(&ks_e,KE);
 
-int WorkerThread(
-  unsigned char *AES_PT,
-  unsigned char *AES_KT,
-  unsigned char *AES_CT,
-  unsigned char *ECC_INVA,
-  unsigned char *ECC_INVP,
-  unsigned char *ECC_SCA,
-  unsigned char *ECC_BP,
-  unsigned char *ECC_SMP,
-  unsigned char *ECC_INA,
-  unsigned char *ECC_INB,
-  unsigned char *ECC_PRD,
-  unsigned char *HASH_MSG,
-  unsigned char *HASH_DGST,
-  unsigned char *BLM_MSG,
-  unsigned char *BLM_DGST,
-  unsigned char *MGDB_RES,
-  unsigned char *MGDB_BIDX,
-  unsigned char *MGDB_JIDX,
-  unsigned char *MGDB_LBL,
-  unsigned int *OPCODE
-)
-{
+    //xind, once per id
+    AESENC_N(&ks_i,XID,ID,n);
 
-    int nNextIteration = 1;
+    //Zw = PRF(KZ, W || c), c counts the ids of the whole row
+    for(uint32_t i=0;i<n;++i){
+        uint32_t c = id_begin + i;
+        ::memcpy(WC+(16*i),W,16);
+        WC[(16*i)+15] = c & 0xFF;
+        WC[(16*i)+14] = (c >> 8) & 0xFF;
+    }
+    AESENC_N(&ks_z,ZW,WC,n);
 
-    Redis redis_thread(connection_options, pool_options);
-    blake3_hasher hasher;
-    blake3_hasher_init(&hasher);
+    //AES Encryption of id using KE
+    AESENC_N(&ks_e,EC+(16*id_begin),ID,n);
 
-    while(!processed){
-        std::unique_lock<std::mutex> lock(mrun);
-        dataReady.wait(lock, [&nNextIteration] { return nCurrentIteration==nNextIteration; });
-        lock.unlock();
+    //32 byte operands, the value in the low half
+    for(uint32_t i=0;i<n;++i){
+        ::memcpy(ZWP+(32*i)+16,ZW+(16*i),16);
+        ::memcpy(XIDA+(32*i)+16,XID+(16*i),16);
+        ::memcpy(kxw_arr+(32*i)+16,kxw,16);
+    }
 
-        ++nNextIteration;
+    //y = xind * Zw^-1
+    ECC_FPINV_N(ZWP,ZWI,n);
+    ECC_MUL_N(XIDA,ZWI,YID+(32*id_begin),n);
 
-        //Do thread stuff here
-        if(*OPCODE == 1){
-            AESENC(AES_CT,AES_PT,AES_KT);
-        }
-        else if(*OPCODE == 2){
-            SHA3_HASH(&hasher,HASH_MSG,HASH_DGST);
-        }
-        else if(*OPCODE == 3){
-            SHA3_HASH_K(&hasher,BLM_MSG,BLM_DGST);
-        }
-        else if(*OPCODE == 4){
-            ECC_MUL(ECC_INA,ECC_INB,ECC_PRD);
-        }
-        else if(*OPCODE == 5){
-            ECC_FPINV(ECC_INVA,ECC_INVP);
-        }
-        else if(*OPCODE == 6){
-            ScalarMul(ECC_SMP,ECC_SCA,ecc_basep);
-        }
-        else if(*OPCODE == 7){
-            ScalarMul(ECC_SMP,ECC_SCA,ECC_BP);
-        }
-        else if(*OPCODE == 8){
-            string s = HexToStr(MGDB_BIDX,2) + HexToStr(MGDB_JIDX,2) + HexToStr(MGDB_LBL,12);
-            auto val = redis_thread.get(s);
-            unsigned char *t_res = reinterpret_cast<unsigned char *>(val->data());
-            DB_StrToHex49(MGDB_RES,t_res);
-        }
-        else if(*OPCODE == 9){
-            PRF(AES_CT,AES_PT,AES_KT);
-        }
-        else{
-            std::this_thread::sleep_for (std::chrono::milliseconds(1));//Check if it results in computation error
-        }
+    //xtag = g^(kxw * xind)
+    ECC_MUL_N(kxw_arr,XIDA,xid_kwx,n);
+    ScalarMulBase_N(gfp_kwx,xid_kwx,n);
 
-        lock.lock();
-        if (--nWorkerCount == 0)
-        {
-          lock.unlock();
-          workComplete.notify_one();
+    //N_HASH digests H(xtag || j) per xtag, then its Bloom filter bits
+    for(uint32_t i=0;i<n;++i){
+        for(int j=0;j<N_HASH;++j){
+            ::memcpy(blm_msg+(40*j),gfp_kwx+(32*i),32);
+            blm_msg[(40*j)+39] = (j & 0xFF);
         }
+        Blake3_Many(bhash,64,blm_msg,40,40,N_HASH);
+        BloomFilter_Indices(bhash,bf_indices);
+        BloomFilter_SetAtomic(BF,bf_indices);
     }
+
     return 0;
 }
 
+//Rows are processed in batches of about EDB_BATCH_IDS ids. Every row of a batch is
+//cut into tasks of at most EDB_TASK_IDS ids, and the tasks of the whole batch go to
+//the task engine together, so the many rows with only a few ids keep all workers
+//busy. Results land at the ids' positions in the batch, and the rows are appended
+//to the encrypted index in file order once the batch is done.
+//The TSet is built from the finished encrypted index afterwards.
 int EDB_SetUp(int socket_fd)
 {
-    unsigned char *W;
-    unsigned char *KE;
-    unsigned char *ID;
-    unsigned char *XID;
-    unsigned char *XIDA;
-    unsigned char *WC;
-    unsigned char *ZW;
-    unsigned char *ZWP;
-    unsigned char *EC;
-    unsigned char *ZWI;
-    unsigned char *YID;
-    
-    int N_words = 0;
-    unsigned int N_max_id_words = 0;
-    
-    N_words = (N_max_ids/N_threads) + ((N_max_ids%N_threads==0)?0:1);
-    N_max_id_words = N_words * N_threads;
-
-    W = new unsigned char[16];//Holds the keyword
-    KE = new unsigned char[16];//ID encryption key
-    ID = new unsigned char[16*N_max_id_words];//Maximum number of IDs in a row
-    XID = new unsigned char[16*N_max_id_words];//Maximum number of IDs in a row
-    XIDA = new unsigned char[32*N_max_id_words];//XID for multiplication with Zinv
-    WC = new unsigned char[16*N_max_id_words];//IDs with counter value
-    ZW = new unsigned char[16*N_max_id_words];//Z value
-    ZWP = new unsigned char[32*N_max_id_words];//Z value for computing inverse
-    EC = new unsigned char[16*N_max_id_words];//Encrypted IDs
-    ZWI = new unsigned char[32*N_max_id_words];//Z values inverse
-    YID = new unsigned char[32*N_max_id_words];//Encrypted Y (mul of XIDA and ZWI)
-
-    ifstream widxdb_file_handle(widxdb_file);
-    // widxdb_file_handle.open(widxdb_file,ios_base::in|ios_base::binary);
-
-    ofstream eidxdb_file_handle(eidxdb_file);
-    // eidxdb_file_handle.open(eidxdb_file,ios_base::out|ios_base::binary);
+    struct SetUpTask {
+        uint32_t row;
+        uint32_t id_begin;
+        uint32_t id_end;
+    };
 
-    stringstream ss;
+    unsigned char W[16];
 
-    string widxdb_row;
-    vector<string> widxdb_data;
-    string widxdb_row_current;
-    string s;
-
-    ::memset(W,0x00,16);
-    ::memset(KE,0x00,16);
-    ::memset(ID,0x00,16*N_max_id_words);
-    ::memset(XID,0x00,16*N_max_id_words);
-    ::memset(WC,0x00,16*N_max_id_words);
-    ::memset(ZWI,0x00,32*N_max_id_words);
-    ::memset(ZWP,0x00,32*N_max_id_words);
-    ::memset(XIDA,0x00,32*N_max_id_words);
-    ::memset(ZW,0x00,16*N_max_id_words);
-    ::memset(EC,0x00,16*N_max_id_words);
-    ::memset(YID,0x00,32*N_max_id_words);
-
-    unsigned char *zw_local = ZW;
-    unsigned char *zwp_local = ZWP;
-    unsigned char *zwi_local = ZWI;
-    unsigned char *id_local = ID;
-    unsigned char *xid_local = XID;
-    unsigned char *xida_local = XIDA;
-    unsigned char *wc_local = WC;
-    unsigned char *ec_local = EC;
-    unsigned char *yid_local = YID;
-
-    unsigned char *local_s;
-
-    //int N_words = 0;
-    int n_rows = 0;
-    int n_row_ids = 0;
-
-    widxdb_row.clear();
-    while(getline(widxdb_file_handle,widxdb_row)){
-        widxdb_data.push_back(widxdb_row);
-        widxdb_row.clear();
-        n_rows++;
+    //Parsed once into CSR form
+    WIdxDB widx_db;
+    if(WIdx_Load(&widx_db,widxdb_file) < 0){
+        return -1;
+    }
+    if(widx_db.max_row_ids > (uint32_t)N_max_ids){
+        cout << widxdb_file << " has a row of " << widx_db.max_row_ids << " ids, more than N_max_ids" << endl;
+        WIdx_Release(&widx_db);
+        return -1;
     }
 
-    cout << "Number of Keywords: " << n_rows << endl;
-
-    widxdb_file_handle.close();
-
-    for(int n=0;n<n_rows;++n){
-
-        zw_local = ZW;
-        zwp_local = ZWP;
-        xid_local = XID;
-        wc_local = WC;
-
-        ::memset(KE,0x00,16);
-        ::memset(ID,0x00,16*N_max_id_words);
-        ::memset(ZWP,0x00,32*N_max_id_words);
-        ::memset(ZWI,0x00,32*N_max_id_words);
-        ::memset(XIDA,0x00,32*N_max_id_words);
-        ::memset(EC,0x00,16*N_max_id_words);
-        ::memset(YID,0x00,32*N_max_id_words);
-
-        widxdb_row_current = widxdb_data.at(n);
-
-        ss.str(std::string());
-        ss << widxdb_row_current;
-        std::getline(ss,s,',');//Get the keyword
-
-        DB_StrToHex8(W,s.data());//Read the keyword
-
-        id_local = ID;
-
-        n_row_ids = 0;//For row id count
-        while(std::getline(ss,s,',') && !ss.eof()) {
-            if(!s.empty()){
-                DB_StrToHex8(id_local,s.data());//Read the id
-                id_local += 16;
-                n_row_ids++;
-            }
-        }
+    EIdxWriter eidx_writer;
+    if(EIdx_WriterOpen(&eidx_writer,eidxdb_file) < 0){
+        WIdx_Release(&widx_db);
+        return -1;
+    }
 
-        ss.clear();
-        ss.seekg(0);
+    //A row is never split across batches
+    uint64_t batch_cap = std::max<uint64_t>(EDB_BATCH_IDS,widx_db.max_row_ids);
+    std::vector<unsigned char> YID(32*batch_cap);//Encrypted Y of the batch
+    std::vector<unsigned char> EC(16*batch_cap);//Encrypted IDs of the batch
+    std::vector<SetUpTask> tasks;
 
-        N_words = (n_row_ids/N_threads) + ((n_row_ids%N_threads==0)?0:1);
+    uint32_t n_rows = widx_db.n_rows;
 
-        id_local = ID;//Set local id pointer to the beginning of the array
+    cout << "Number of Keywords: " << n_rows << endl;
 
-        AESENC(KE,W,KS);//Generate KE from W and KS
+    uint32_t row_begin = 0;
+    while(row_begin < n_rows){
 
-        id_local = ID;
-        xid_local = XID;
-        for(int nword = 0;nword < N_words;++nword){
-            // FPGA_AES_ENC(id_local,KI,xid_local);
-            FPGA_PRF(id_local,KI,xid_local);
-            id_local += sym_block_size;
-            xid_local += sym_block_size;
+        uint32_t row_end = row_begin;
+        uint64_t base = widx_db.offsets[row_begin];
+        while(row_end < n_rows && (row_end == row_begin || widx_db.offsets[row_end+1] - base <= EDB_BATCH_IDS)){
+            ++row_end;
         }
-        id_local = ID;
-        xid_local = XID;
 
-
-        //PRF with C value Appended
-        wc_local = WC;
-        for(int nword = 0;nword < N_words;++nword){
-            for(int nid=0;nid<N_threads;++nid){
-    	         ::memcpy(wc_local,W,16);
-               wc_local += 16;
+        tasks.clear();
+        for(uint32_t r=row_begin;r<row_end;++r){
+            uint32_t n_row_ids = WIdx_RowIds(&widx_db,r);
+            for(uint32_t i=0;i<n_row_ids;i+=EDB_TASK_IDS){
+                tasks.push_back({r,i,std::min<uint32_t>(n_row_ids,i+EDB_TASK_IDS)});
             }
         }
-        wc_local = WC;
-        
-        //Compute Zw after appending c
-        unsigned int count_wc = 0;
-        unsigned int count_wc_local = 0;
-        for(unsigned int nword = 0;nword < n_row_ids;++nword){
-            count_wc_local = count_wc;
-            WC[(nword*16)+15] = count_wc_local & 0xFF;
-            count_wc_local >>= 8;
-            WC[(nword*16)+14] = count_wc_local & 0xFF;
-            count_wc++;
-        }
-
 
-        wc_local = WC;
-        zw_local = ZW;
-        for(int nword = 0;nword < N_words;++nword){
-            // FPGA_AES_ENC(wc_local,KZ,zw_local);
-            FPGA_PRF(wc_local,KZ,zw_local);
-            wc_local += sym_block_size;
-            zw_local += sym_block_size;
-        }
-        wc_local = WC;
-        zw_local = ZW;
-
-        //AES Encryption of id using KE
-        id_local = ID;
-        ec_local = EC;
-        for(int nword = 0;nword < N_words;++nword){
-            FPGA_AES_ENC(id_local,KE,ec_local);
-            id_local += sym_block_size;
-            ec_local += sym_block_size;
-        }
-        id_local = ID;
-        ec_local = EC;
-
-        //Prepare for inverse computation
-        zw_local = ZW;
-        zwp_local = ZWP;
-        for(int nword = 0;nword < N_words;++nword){
-            for(int nid=0;nid<N_threads;++nid){
-                ::memcpy(zwp_local+16,zw_local,16);
-                zw_local += 16;//sym_block_size;
-                zwp_local += 32;//ecc_block_size;
+        const WIdxDB *db = &widx_db;
+        const SetUpTask *task_arr = tasks.data();
+        unsigned char *yid_arr = YID.data();
+        unsigned char *ec_arr = EC.data();
+        TaskEngine_Run(tasks.size(), 1, [=](size_t begin, size_t end){
+            for(size_t t=begin;t<end;++t){
+                uint64_t off = db->offsets[task_arr[t].row] - base;
+                EDB_SetUpTask(db,task_arr[t].row,task_arr[t].id_begin,task_arr[t].id_end,yid_arr+(32*off),ec_arr+(16*off));
             }
-        }
-        zw_local = ZW;
-        zwp_local = ZWP;
-
-        //Compute inverse of zw
-        zwi_local = ZWI;
-        zwp_local = ZWP;
-        for(int nword = 0;nword < N_words;++nword){
-            FPGA_ECC_FPINV(zwp_local,zwi_local);
-            zwp_local += ecc_block_size;
-            zwi_local += ecc_block_size;
-        }
-        zwi_local = ZWI;
-        zwp_local = ZWP;
-
-        //Copy XID array for multiplication
-        xid_local = XID;
-        xida_local = XIDA;
-        for(int nword = 0;nword < N_words;++nword){
-            for(int nid=0;nid<N_threads;++nid){
-                ::memcpy(xida_local+16,xid_local,16);
-                xid_local += 16;
-                xida_local += 32;
+        });
+
+        for(uint32_t r=row_begin;r<row_end;++r){
+            uint64_t off = widx_db.offsets[r] - base;
+            ::memset(W,0x00,16);
+            ::memcpy(W,WIdx_RowKeyword(&widx_db,r),WIDX_KW_LEN);
+            if(EIdx_WriterAppend(&eidx_writer,W,YID.data()+(32*off),EC.data()+(16*off),WIdx_RowIds(&widx_db,r)) < 0){
+                cout << "Could not write " << eidxdb_file << endl;
+                EIdx_WriterClose(&eidx_writer);
+                WIdx_Release(&widx_db);
+                return -1;
             }
         }
-        xid_local = XID;
-        xida_local = XIDA;
-
-        //Multiply XID and ZWI  = YC
-        xida_local = XIDA;
-        zwi_local = ZWI;
-        yid_local = YID;
-        for(int nword = 0;nword < N_words;++nword){
-            FPGA_ECC_MUL(xida_local,zwi_local,yid_local); //Verify again
-            xida_local += ecc_block_size;
-            zwi_local += ecc_block_size;
-            yid_local += ecc_block_size;
-        }
-        xida_local = XIDA;
-        zwi_local = ZWI;
-        yid_local = YID;
 
-
-        eidxdb_file_handle << DB_HexToStr8(W) << ',';
-        for(int n_eidx=0;n_eidx < n_row_ids;++n_eidx){
-            eidxdb_file_handle << HexToStr(YID+(32*n_eidx),32) << HexToStr(EC+(16*n_eidx),16) + ",";
-        }
-        eidxdb_file_handle << endl;
+        row_begin = row_end;
     }
 
-    eidxdb_file_handle.close();
+    if(EIdx_WriterClose(&eidx_writer) < 0){
+        WIdx_Release(&widx_db);
+        return -1;
+    }
 
-/////////////////////////////////////////////////////////////////////////////////////////////////
+    WIdx_Release(&widx_db);
 
-    cout << "Encrypted Index Generation Done!" << endl;
+    cout << "Encrypted Index and Bloom filter Generation Done!" << endl;
     cout << "Executing TSet Setup..." << endl;
 
-    TSet_SetUp(socket_fd);
-
-    cout << "TSet SetUp Done!" << endl;
-    cout << "Generating Bloom filter..." << endl;
-
-/////////////////////////////////////////////////////////////////////////////////////////////////
-
-    unsigned char *bhash;
-    unsigned char *kxw;
-    unsigned char *kxw_arr;
-    unsigned char *xid_arr;
-    unsigned char *xid_kwx;
-    unsigned char *gfp_kwx;
-
-    bhash = new unsigned char[64*N_threads];
-    kxw = new unsigned char[16];
-    kxw_arr = new unsigned char[32*N_max_id_words];
-    xid_arr = new unsigned char[32*N_max_id_words];
-    xid_kwx = new unsigned char[32*N_max_id_words];
-    gfp_kwx = new unsigned char[32*N_max_id_words];
-
-    unsigned int bfidx = 0;
-    unsigned int bf_indices[N_HASH];
-
-    ::memset(bhash,0x00,64*N_threads);
-    ::memset(W,0x00,16);
-    ::memset(kxw,0x00,16);
-    ::memset(kxw_arr,0x00,32*N_max_id_words);
-    ::memset(XID,0x00,16*N_max_id_words);
-
-    unsigned char *kxw_arr_local = kxw_arr;
-    unsigned char *xid_arr_local = xid_arr;
-    unsigned char *xid_kwx_local = xid_kwx;
-    unsigned char *gfp_kwx_local = gfp_kwx;
-
-    xid_local = XID;//declared previously
-
-    ss.clear();
-    ss.seekg(0);
-
-    for(int n=0;n<n_rows;++n){
-        ::memset(W,0x00,16);
-        ::memset(ID,0x00,16*N_max_id_words);
-        ::memset(XID,0x00,16*N_max_id_words);
-
-        ::memset(kxw_arr,0x00,32*N_max_id_words);
-        ::memset(xid_arr,0x00,32*N_max_id_words);
-        ::memset(xid_kwx,0x00,32*N_max_id_words);
-        ::memset(gfp_kwx,0x00,32*N_max_id_words);
-
-        id_local = ID;
-
-        widxdb_row_current = widxdb_data.at(n);
-
-        ss.str(std::string());
-        ss << widxdb_row_current;
-
-        std::getline(ss,s,',');//Get the keyword
-        DB_StrToHex8(W,s.data());//Read the keyword
-
-        n_row_ids = 0;//Row id count
-        while(std::getline(ss,s,',') && !ss.eof()) {
-            if(!s.empty()){
-                DB_StrToHex8(id_local,s.data());//Read the id
-                id_local += 16;
-                n_row_ids++;
-            }
-        }
-
-        ss.clear();
-        ss.seekg(0);
-
-        N_words = (n_row_ids/N_threads) + ((n_row_ids%N_threads==0)?0:1);
-
-        id_local = ID;
-
-        AESENC(kxw,W,KX);
-
-        //Encrypt IDs
-        id_local = ID;
-        xid_local = XID;
-
-        for(int nword = 0;nword < N_words;++nword){
-            // FPGA_AES_ENC(id_local,KI,xid_local);
-            FPGA_PRF(id_local,KI,xid_local);
-            id_local += sym_block_size;
-            xid_local += sym_block_size;
-        }
-        id_local = ID;
-        xid_local = XID;
-
-        //Copy XID array for multiplication
-        kxw_arr_local = kxw_arr;
-        xid_arr_local = xid_arr;
-        xid_local = XID;
-        for(int nword = 0;nword < N_words;++nword){
-            for(int nid=0;nid<N_threads;++nid){
-                ::memcpy(kxw_arr_local+16,kxw,16);
-                ::memcpy(xid_arr_local+16,xid_local,16);
-                kxw_arr_local += 32;
-                xid_arr_local += 32;
-                xid_local += 16;
-            }
-        }
-        kxw_arr_local = kxw_arr;
-        xid_arr_local = xid_arr;
-        xid_local = XID;
-
-        //Multiply Keyword - IDs
-        kxw_arr_local = kxw_arr;
-        xid_arr_local = xid_arr;
-        xid_kwx_local = xid_kwx;
-        for(int nword = 0;nword < N_words;++nword){
-            FPGA_ECC_MUL(kxw_arr_local,xid_arr_local,xid_kwx_local);
-            kxw_arr_local += ecc_block_size;
-            xid_arr_local += ecc_block_size;
-            xid_kwx_local += ecc_block_size;
-        }
-        kxw_arr_local = kxw_arr;
-        xid_arr_local = xid_arr;
-        xid_kwx_local = xid_kwx;
-
-        //Multiply Keyword - IDs
-        gfp_kwx_local = gfp_kwx;
-        xid_kwx_local = xid_kwx;
-        for(int nword = 0;nword < N_words;++nword){
-            FPGA_ECC_SCAMUL(xid_kwx_local,gfp_kwx_local);
-            gfp_kwx_local += ecc_block_size;
-            xid_kwx_local += ecc_block_size;
-        }
-        gfp_kwx_local = gfp_kwx;
-        xid_kwx_local = xid_kwx;
-
-        for(int i=0;i<n_row_ids;++i){
-
-            ::memset(bhash,0x00,bhash_block_size);
-            ::memset(bf_indices,0x00,N_HASH);
-            FPGA_BLOOM_HASH(gfp_kwx_local,bhash);
-
-            for(int j=0;j<N_HASH;++j){
-                bf_indices[j] = BFIdxConv(bhash+(64*j),N_BF_BITS);
-                // bf_indices[j] = (bhash[64*j] & 0xFF) + ((bhash[64*j+1] & 0xFF) << 8) + ((bhash[64*j+2] & 0x01) << 16);
-            }
-
-            BloomFilter_Set(BF, bf_indices);
-
-            gfp_kwx_local +=32;
-        }
-
-        gfp_kwx_local = gfp_kwx;
+    if(TSet_SetUp(socket_fd) < 0){
+        return -1;
     }
 
-    cout << "Bloom filter generation complete!" << endl;
-
-    delete [] bhash;
-    delete [] kxw;
-    delete [] kxw_arr;
-    delete [] xid_arr;
-    delete [] xid_kwx;
-    delete [] gfp_kwx;
-
-    delete [] W;
-    delete [] KE;
-    delete [] ID;
-    delete [] XID;
-    delete [] XIDA;
-    delete [] WC;
-    delete [] ZW;
-    delete [] ZWP;
-    delete [] EC;
-    delete [] ZWI;
-    delete [] YID;
+    cout << "TSet SetUp Done!" << endl;
 
     return 0;
 }
 
+//Request ids only have to be unique on one connection
+static uint32_t search_request_id = 0;
+
 int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
 {
     cout<<"NWords = "<<NWords<<endl;
     unsigned char Q1[16];
 
     unsigned char *stag;
-    unsigned char *tset_row;
     unsigned char *WC;
     unsigned char *FW1;
     unsigned char *KXWL;
@@ -810,9 +435,6 @@ int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
     unsigned char *G_FW1;
     unsigned char *GFW_KX;
     unsigned char *XTOKEN;
-    unsigned char *XTAG;
-    unsigned char *bhash;
-    unsigned char *ESET;
     
     int N_words = 0;
     unsigned int N_max_id_words = 0;
@@ -821,67 +443,25 @@ int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
     N_max_id_words = N_words * N_threads;
 
     stag = new unsigned char[16];
-    tset_row = new unsigned char[48*N_max_id_words];
     WC = new unsigned char[16*N_max_id_words];
     FW1 = new unsigned char[16*N_max_id_words];
     KXWL = new unsigned char[16*N_max_id_words];
     FPKXWL = new unsigned char[16*N_max_id_words];
-    G_WC = new unsigned char[32*N_max_id_words];
-    G_FW1 = new unsigned char[32*N_max_id_words];
-    GFW_KX = new unsigned char[32*N_max_id_words];
-    XTOKEN = new unsigned char[32*N_max_id_words];
-    XTAG = new unsigned char[32*N_max_id_words];
-    bhash = new unsigned char[64*N_threads];
-    ESET = new unsigned char[16*N_max_id_words];
 
-    unsigned char *YID_ALL;
-    YID_ALL = new unsigned char[32*N_max_id_words];
-
-    unsigned char YID[32];
-    unsigned char ECE[16];
-
-    bool idx_in_set = false;
     int nmatch = 0;
-    unsigned int bfidx = 0;
-
-    unsigned int** bf_n_indices;
-
     int n_ids_tset = 0;
 
-    double time_elapsed;
-
-    bf_n_indices = new unsigned int * [N_HASH];
-    for(unsigned int i=0;i<N_HASH;++i){
-        bf_n_indices[i] = new unsigned int [NWords];//check what happens if NWords is 0
-    }
-
     ::memset(stag,0x00,16);
-    ::memset(tset_row,0x00,48*N_max_id_words);
     ::memset(WC,0x00,16*N_max_id_words);
     ::memset(FW1,0x00,16*N_max_id_words);
     ::memset(KXWL,0x00,16*N_max_id_words);
     ::memset(FPKXWL,0x00,16*N_max_id_words);
-    ::memset(G_WC,0x00,32*N_max_id_words);
-    ::memset(G_FW1,0x00,32*N_max_id_words);
-    ::memset(GFW_KX,0x00,32*N_max_id_words);
-    ::memset(XTOKEN,0x00,32*N_max_id_words);
-    ::memset(XTAG,0x00,32*N_max_id_words);
-    ::memset(ESET,0x00,16*N_max_id_words);
-    ::memset(YID_ALL,0x00,32*N_max_id_words);
-
-    unsigned char *wc_local = WC;
-    unsigned char *fw1_local = FW1;
 
-    unsigned char *kxwl_local = KXWL;
+    unsigned char *fw1_local = FW1;
     unsigned char *fpkxwl_local = FPKXWL;
 
-    unsigned char *g_wc_local = G_WC;
-    unsigned char *g_fw1_local = G_FW1;
-
-    unsigned char *tset_row_local = tset_row;
-    unsigned char *xtg_local = nullptr;
-    unsigned char *eset_local = ESET;
-    unsigned char *yid_local = YID_ALL;
+    unsigned char *g_wc_local = nullptr;
+    unsigned char *g_fw1_local = nullptr;
 
     ::memcpy(Q1,query_str,16); // Q1 is the first keyword in the conjunctive query
 
@@ -889,17 +469,22 @@ int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
 
     /*
     
-    send stag to server
+    send NWords || stag to server
     
     */
-    size_t stag_size = 16;
-    send_all(socket_fd, stag, stag_size);
-    cout<<"[CLIENT] Sent stag = ";
-    printMemoryNibbles(stag, stag_size);
-
-
-
-    // TSet_Retrieve(stag,tset_row,&n_ids_tset);
+    uint32_t request_id = ++search_request_id;
+    bool search_ok = true;
+    MsgHeader hdr;
+    std::vector<unsigned char> msg_payload;
+    unsigned char request[SEARCH_REQUEST_LEN];
+
+    uint32_t nwords_req = NWords;
+    ::memcpy(request,&nwords_req,4);
+    ::memcpy(request+4,stag,16);
+    if(Msg_Send(socket_fd, MSG_SEARCH_REQUEST, request_id, request, SEARCH_REQUEST_LEN) != 0){
+        cout<<"[CLIENT] Failed to send search request "<<request_id<<endl;
+        search_ok = false;
+    }
 
     /* 
     
@@ -916,10 +501,20 @@ int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
     receive n_ids_test from server
     
     */
-    size_t n_ids_tset_size = sizeof(n_ids_tset);
-    recv_all(socket_fd, (unsigned char*)&n_ids_tset, n_ids_tset_size);
-    cout<<"[CLIENT] Recvd n_ids_tset = ";
-    printMemoryNibbles(&n_ids_tset, n_ids_tset_size);
+    if(search_ok && Msg_Recv(socket_fd, &hdr, msg_payload, sizeof(n_ids_tset)) == 0 &&
+       hdr.type == MSG_SEARCH_NIDS && hdr.request_id == request_id && hdr.length == sizeof(n_ids_tset)){
+        ::memcpy(&n_ids_tset,msg_payload.data(),sizeof(n_ids_tset));
+    }
+    else if(search_ok){
+        cout<<"[CLIENT] Bad reply to search request "<<request_id<<endl;
+        search_ok = false;
+    }
+
+    //The server never returns more than N_max_ids entries for a keyword
+    if(!search_ok || n_ids_tset < 0 || n_ids_tset > N_max_ids){
+        search_ok = false;
+        n_ids_tset = 0;
+    }
 
     cout << "N IDs TSet: " << n_ids_tset << endl;
 
@@ -965,15 +560,7 @@ int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
     this part of code only executed at the client side
     
     */
-    wc_local = WC;
-    fw1_local = FW1;
-    for(int nword = 0;nword < N_words;++nword){
-        // FPGA_AES_ENC(wc_local,KZ,fw1_local);
-        FPGA_PRF(wc_local,KZ,fw1_local); // computation of z
-        wc_local += sym_block_size;
-        fw1_local += sym_block_size;
-    }
-    wc_local = WC;
+    FPGA_PRF(WC,KZ,FW1,N_words*N_threads); // computation of z
     fw1_local = FW1;
     // fw1_local contains array of z s i believe
 
@@ -983,176 +570,103 @@ int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
     this part of code only executed at the client side
     
     */
-    kxwl_local = KXWL;
-    fpkxwl_local = FPKXWL;
-    for(int nword = 0;nword < N_words;++nword){
-        // FPGA_AES_ENC(kxwl_local,KX,fpkxwl_local);
-        FPGA_PRF(kxwl_local,KX,fpkxwl_local); // The other w_i (i!=1) specific thingy multiplied with z to get z 
-        kxwl_local += sym_block_size;
-        fpkxwl_local += sym_block_size;
-    }
-    kxwl_local = KXWL;
-    fpkxwl_local = FPKXWL;
-
-    // xtoken[c,i] = wc_local[c] * kxwl_local[i]
+    FPGA_PRF(KXWL,KX,FPKXWL,N_words*N_threads); // The other w_i (i!=1) specific thingy multiplied with z to get z 
 
-    // tset_row_local = tset_row;
-    /* the (e,y) pairs are neither available nor required in client */
+    // xtoken[c,i] = FW1[c] * FPKXWL[i]
 
-    for(int n=0;n<n_ids_tset;++n){
-        // here we are iterating over all (e,y) pairs obtained from TSetRetrieve(Tset,stag) :
-        // look at how things are updated at the end: 
-        // tset_row_local +=48; each (e,y) pair is 48bytes, actually the first 32 bytes are y part and last 16 bytes are e part
-        // fw1_local += 16;
-
-        idx_in_set = false;
+    /*
+    
+    this part of code only executed at the client side
 
-        /*
-        
-        this part of code only executed at the client side
+    xtokens are computed in windows of SEARCH_XTOKEN_WINDOW counters, lane (n*NWords)+i holds xtoken[n][i].
+    The header of the xtoken message goes out first and every window is sent as soon as it is done,
+    so the server checks the first entries while the later xtokens are still being computed
+    
+    */
+    size_t n_xtoken_lanes = (size_t)n_ids_tset * NWords;
+    size_t n_window_lanes = (size_t)SEARCH_XTOKEN_WINDOW * NWords;
+
+    G_WC = new unsigned char[32*n_window_lanes];
+    G_FW1 = new unsigned char[32*n_window_lanes];
+    GFW_KX = new unsigned char[32*n_window_lanes];
+    XTOKEN = new unsigned char[32*n_window_lanes];
+
+    ::memset(G_WC,0x00,32*n_window_lanes);
+    ::memset(G_FW1,0x00,32*n_window_lanes);
+    ::memset(GFW_KX,0x00,32*n_window_lanes);
+    ::memset(XTOKEN,0x00,32*n_window_lanes);
+
+    uint64_t xtoken_len = 32*n_xtoken_lanes;
+    if(search_ok && Msg_SendHeader(socket_fd, MSG_SEARCH_XTOKEN, request_id, xtoken_len) != 0){
+        cout<<"[CLIENT] Failed to send xtokens of request "<<request_id<<endl;
+        search_ok = false;
+    }
 
-        */
-        ::memset(G_WC,0x00,32*N_max_id_words);
-        ::memset(G_FW1,0x00,32*N_max_id_words);
-        ::memset(GFW_KX,0x00,32*N_max_id_words);
-        ::memset(GFW_KX,0x00,32*N_max_id_words);
-        ::memset(ECE,0x00,16);
+    for(int win_begin=0;search_ok && win_begin<n_ids_tset;win_begin+=SEARCH_XTOKEN_WINDOW){
+        int win_end = std::min(win_begin+SEARCH_XTOKEN_WINDOW,n_ids_tset);
+        size_t win_lanes = (size_t)(win_end-win_begin) * NWords;
 
         g_wc_local = G_WC;
         g_fw1_local = G_FW1;
-        fpkxwl_local = FPKXWL;
-        yid_local = YID_ALL;
-
-        for(int i=0;i<NWords;++i){
-            ::memcpy(g_wc_local+16,fpkxwl_local,16);
-            ::memcpy(g_fw1_local+16,fw1_local,16);
-            g_wc_local += 32;
-            g_fw1_local += 32;
-            fpkxwl_local += 16;
-            // fw1_local does not change in this loop => we are doing this for the same counter value
-        }
-
-        g_wc_local = G_WC; // Fp(Kx, w_i) for i \in {2,3,...,NWords}
-        g_fw1_local = G_FW1; // Fp(Kz, w1||c), same entry in all cels of g_fe1_local
-        fpkxwl_local = FPKXWL; // essentially same thing: as g_wc_local, // Fp(Kx, w_i) for i \in {2,3,...,NWords}, exect that each entry in g_wc_local is 32 bytes but each entry in gpkxwl is 16 bytes. last 16 bytes of g_wc_local are same as the corresponding entry in fpkxwl
-
-        FPGA_ECC_MUL(G_WC,G_FW1,GFW_KX);//Assumed that NWords is less than n threads
-        // i am assuming this GFW_KX stores [Fp(Kz,w1||c).Fp(Kx,w_i)], i!=1
-
-        FPGA_ECC_SCAMUL(GFW_KX,XTOKEN);//Assumed that NWords is less than n threads
-
-        /*
-        
-        upto here only executed in the client
-        
-        */
-
-
-        // ::memcpy(YID,tset_row_local,32); // get the y part from this (e,y) pair
-        // ::memcpy(ECE,tset_row_local+32,16); // get the e part from this (e,y) pair
-        /* above part of code only executed at the server, as client does not have access to the tset_row, aka the list of (e,y) pairs */
-
-        // now we are going towards veryifying whether g^(Fp(Kz,w1||c).Fp(Kx,w_i),y) for all i \in {2,3,..,NWords}
-
-
-
-        /*
-        
-        this is a good time to send the XTOKEN to the server
-
-        therefore,
-        send XTOKEN
-        
-        */
-       size_t xtoken_size = 32*N_max_id_words;
-       send_all(socket_fd, XTOKEN, xtoken_size);
-       cout<<"[CLIENT] Sent XTOKEN = ";
-       printMemoryNibbles(XTOKEN, xtoken_size);
-
-
-        // yid_local = YID_ALL;
-        // for(int i=0;i<NWords;++i){//This should run till row_len
-        //     ::memcpy(yid_local,YID,32);
-        //     yid_local += 32;
-        // }
-        // yid_local = YID_ALL; // we copied y of this (e,y) in all Nwords cells of YID_ALL
-        /* above part of code is executed only in the server, only server has y */
-
-        if(NWords == 0){
-            // ::memcpy(eset_local,ECE,16);
-            // eset_local +=16;
-            /* it is the server's headache to do the above thing */
-            // ++nmatch;
+        fw1_local = FW1 + (16*win_begin);
+
+        for(int n=win_begin;n<win_end;++n){
+            fpkxwl_local = FPKXWL;
+            for(int i=0;i<NWords;++i){
+                ::memcpy(g_wc_local+16,fpkxwl_local,16); // Fp(Kx, w_i) for i \in {2,3,...,NWords}
+                ::memcpy(g_fw1_local+16,fw1_local,16); // Fp(Kz, w1||c), same for all words of this counter
+                g_wc_local += 32;
+                g_fw1_local += 32;
+                fpkxwl_local += 16;
+            }
+            fw1_local += 16; // next counter
         }
-        else{
-            // //xtag computation
-
-            // FPGA_ECC_SCAMUL_BASE(YID_ALL,XTOKEN,XTAG);//Assumed that NWords is less than 128
-            // // i am assuming we are computing (g^(Fp(Kz,w1||c).Fp(Kx,w_i)))^    y    here
-            // //                                <-------xtoken[c][i]--------> <---y--->
-
-            // xtg_local = XTAG;
-
-            // // just check if xtg is in the damn bloom filter
-            // // ideally all what has happened upto here should happen in the client side, only xtg_local should be sent to the server
-
-            // for(int i=0;i<NWords;++i){//Check this length
 
-            //     ::memset(bhash,0x00,bhash_block_size);
-            //     FPGA_BLOOM_HASH(xtg_local,bhash);
+        FPGA_ECC_MUL(G_WC,G_FW1,GFW_KX,win_lanes);
+        FPGA_ECC_SCAMUL(GFW_KX,XTOKEN,win_lanes);
 
-            //     for(int j=0;j<N_HASH;++j){
-            //         bf_n_indices[j][i] = BFIdxConv(bhash+(64*j),N_BF_BITS);
-            //         // bf_n_indices[j][i] = (bhash[64*j] & 0xFF) + ((bhash[64*j+1] & 0xFF) << 8) + ((bhash[64*j+2] & 0x01) << 16);
-            //     }
-
-            //     xtg_local +=32;
-            // }
-
-            // BloomFilter_Match_N(BF, bf_n_indices, NWords, &idx_in_set); // modifies idx_in_set flag to true if xtag was found in the bloom filter
-
-            // if(idx_in_set){
-            //     ::memcpy(eset_local,ECE,16);
-            //     eset_local +=16; // i guess this is where we are storing the e values of the documents which passed the test, server should return this to client
-            //     ++nmatch;
-            // }
-            /* server is doing the heavy lifting in this part */
-
-            // tset_row_local +=48; // we go to next (e,y) pair
-            // fw1_local += 16; // next counter
-
-
-            /*
-            
-            I dont think updating tset_row_local and fw1_local should ONLY happen in the else part, for the if part (i.e. if NWords==0, then too you need to go to the next (e,y) pair)
-
-            with this understandng, I AM GOING TO TAKE A HUGE RISK AND DO WHAT MY HEAR SAYS, WHICH IS TO MOVE THE TSET_ROW_LOCAL AND FW1_LOCAL UPDATE LOGIC OUT OUT THE ELSE PART, OM SHANTI
-            
-            */
+        if(send_all(socket_fd, XTOKEN, 32*win_lanes) != (ssize_t)(32*win_lanes)){
+            cout<<"[CLIENT] Failed to send xtokens of request "<<request_id<<endl;
+            search_ok = false;
         }
+    }
 
-        tset_row_local +=48; // we go to next (e,y) pair
-        fw1_local += 16; // next counter
+    if(search_ok){
+        cout<<"[CLIENT] Sent "<<n_xtoken_lanes<<" xtokens ("<<xtoken_len<<" bytes)"<<endl;
     }
 
     // server's job should end here
 
     /*
     
-    receive nmatch
-
-    receive ESET
+    receive nmatch || ESET, only the e values of the matching rows are sent
     
     */
-    size_t nmatch_size = sizeof(nmatch);
-    recv_all(socket_fd, (unsigned char*)&nmatch, nmatch_size);
-    cout<<"[CLIENT] Recvd nmatch = ";
-    printMemoryNibbles(&nmatch, nmatch_size);
-
-    size_t ESET_size = 16*N_max_id_words;
-    recv_all(socket_fd, ESET, ESET_size);
-    cout<<"[CLIENT] Recvd ESET = ";
-    printMemoryNibbles(ESET, ESET_size);
+    nmatch = 0;
+    const unsigned char *eset = nullptr;
+    if(search_ok && Msg_Recv(socket_fd, &hdr, msg_payload, sizeof(nmatch)+(16*(uint64_t)n_ids_tset)) == 0 &&
+       hdr.type == MSG_SEARCH_RESULT && hdr.request_id == request_id && hdr.length >= sizeof(nmatch)){
+        ::memcpy(&nmatch,msg_payload.data(),sizeof(nmatch));
+        if(nmatch < 0 || hdr.length != sizeof(nmatch)+(16*(uint64_t)nmatch)){
+            cout<<"[CLIENT] Malformed result for request "<<request_id<<endl;
+            nmatch = 0;
+            search_ok = false;
+        }
+        else{
+            eset = msg_payload.data()+sizeof(nmatch);
+        }
+    }
+    else if(search_ok){
+        if(hdr.type == MSG_ERROR && hdr.length == 4){
+            uint32_t err = 0;
+            ::memcpy(&err,msg_payload.data(),4);
+            cout<<"[CLIENT] Server rejected request "<<request_id<<" with error "<<err<<endl;
+        }
+        else{
+            cout<<"[CLIENT] Bad result for request "<<request_id<<endl;
+        }
+        search_ok = false;
+    }
 
     cout << "Nmatch: " << nmatch << endl;
 
@@ -1162,21 +676,15 @@ int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
 
     AESENC(KE,Q1,KS); // we got the encryted e's, but the key with which these were encrypted was KS. KE = F(KS,w1), here w1 is same as Q1. This step should happen in client
 
-    for(int i=0;i<nmatch;++i){
-        AESDEC(UIDX+(16*i),ESET+(16*i),KE); // write the decrypted doc ids in uidx array, this also happens in the client
-    }
+    AESKeySchedule ke_ks;
+    AES_LoadKey(&ke_ks,KE);
+    AESDEC_N(&ke_ks,UIDX,eset,nmatch); // write the decrypted doc ids in uidx array, this also happens in the client
     
     //auto stop_time = chrono::high_resolution_clock::now();
     //auto time_elapsed = chrono::duration_cast<chrono::microseconds>(stop_time - start_time).count();
     //cout << time_elapsed << endl;
 
-    for(unsigned int i=0;i<N_HASH;++i){
-        delete [] bf_n_indices[i];
-    }
-    delete [] bf_n_indices;
-
     delete [] stag;
-    delete [] tset_row;
     delete [] WC;
     delete [] FW1;
     delete [] KXWL;
@@ -1185,25 +693,21 @@ int EDB_Search(unsigned char *query_str, int NWords, int socket_fd)
     delete [] G_FW1;
     delete [] GFW_KX;
     delete [] XTOKEN;
-    delete [] XTAG;
-    delete [] bhash;
-    delete [] ESET;
 
-    delete [] YID_ALL;
-
-    return nmatch;
+    return search_ok ? nmatch : -1;
 }
 
 
 int TSet_SetUp(int socket_fd)
 {
-    unsigned char *TW;
-    unsigned char *W;
+    const unsigned char *TW = nullptr;
+    const unsigned char *W = nullptr;
     unsigned char *stag;
     unsigned char *stagi;
     unsigned char *stago;
     unsigned char *hashin;
     unsigned char *hashout;
+    unsigned char *TROW;
     
     int N_words = 0;
     unsigned int N_max_id_words = 0;
@@ -1218,13 +722,12 @@ int TSet_SetUp(int socket_fd)
     
     */
 
-    TW = new unsigned char[48*N_max_id_words];
-    W = new unsigned char[16];
     stag = new unsigned char[16];
     stagi = new unsigned char[16*N_max_id_words];
     stago = new unsigned char[16*N_max_id_words];
     hashin = new unsigned char[16*N_max_id_words];
     hashout = new unsigned char[64*N_max_id_words];
+    TROW = new unsigned char[TSET_ENTRY_LEN*N_max_id_words];
 
     //To store TSet Value -- single execution
     unsigned char TVAL[49];
@@ -1242,15 +745,22 @@ int TSet_SetUp(int socket_fd)
 
     FreeB = new unsigned int[len_freeb];
 
-    ifstream eidxdb_file_handle(eidxdb_file);
-    // eidxdb_file_handle.open(eidxdb_file,ios_base::in|ios_base::binary);
-
-    stringstream ss;
-
-    string eidxdb_row;
-    vector<string> eidxdb_data;
-    string eidxdb_row_current;
-    string s;
+    //Rows are read straight out of the mapped file, entries are already y || e
+    EIdxReader eidx_reader;
+    if(EIdx_ReaderOpen(&eidx_reader,eidxdb_file) < 0 || eidx_reader.max_row_ids > (uint32_t)N_max_ids){
+        if(eidx_reader.map != nullptr){
+            cout << "Encrypted index " << eidxdb_file << " has rows longer than N_max_ids" << endl;
+            EIdx_ReaderClose(&eidx_reader);
+        }
+        delete [] stag;
+        delete [] stagi;
+        delete [] stago;
+        delete [] hashin;
+        delete [] hashout;
+        delete [] TROW;
+        delete [] FreeB;
+        return -1;
+    }
 
     ::memset(hashin,0x00,16*N_max_id_words);
     ::memset(hashout,0x00,64*N_max_id_words);
@@ -1260,30 +770,20 @@ int TSet_SetUp(int socket_fd)
         FreeB[bc] = 0;
     }
 
-    int n_rows = 0;
+    int n_rows = (int)eidx_reader.header.n_rows;
     int n_row_ids = 0;
-
-    eidxdb_row.clear();
-    while(getline(eidxdb_file_handle,eidxdb_row)){
-        eidxdb_data.push_back(eidxdb_row);
-        eidxdb_row.clear();
-        n_rows++;
-    }
-
-    eidxdb_file_handle.close();
+    uint32_t n_eidx_ids = 0;
 
     int current_row_len = 0;
 
-    unsigned char *tw_local = TW;
+    const unsigned char *tw_local = TW;
     unsigned char *stagi_local = stagi;
     unsigned char *hashin_local = hashin;
     unsigned char *hashout_local = hashout;
+    unsigned char *trow_local = TROW;
     
     unsigned long id_count = 0;
 
-    std::string db_in_key = "";
-    std::string db_in_val = "";
-
     /*
     
     send value of n_rows to server
@@ -1294,31 +794,15 @@ int TSet_SetUp(int socket_fd)
 
     for(int n=0;n<n_rows;++n){
 
-        ::memset(W,0x00,16);
-        ::memset(TW,0x00,48*N_max_id_words);
         ::memset(stag,0x00,16);
         ::memset(stagi,0x00,16*N_max_id_words);
         ::memset(stago,0x00,16*N_max_id_words);
         ::memset(hashin,0x00,16*N_max_id_words);
         ::memset(hashout,0x00,64*N_max_id_words);
 
-        eidxdb_row_current = eidxdb_data.at(n);
-
-        ss.str(std::string());
-        ss << eidxdb_row_current;
-
-        std::getline(ss,s,',');//Get the keyword
-        DB_StrToHex8(W,s.data());//Read the keyword
-
-        tw_local = TW;
-        n_row_ids = 0;
-        while(std::getline(ss,s,',') && !ss.eof()) {
-            if(!s.empty()){
-                DB_StrToHex48(tw_local,s.data());//Read the id
-                tw_local += 48;
-                n_row_ids++;
-            }
-        }
+        //Records were checked when the file was opened
+        EIdx_ReaderNext(&eidx_reader,&W,&TW,&n_eidx_ids);
+        n_row_ids = (int)n_eidx_ids;
 
         /*
         
@@ -1327,14 +811,11 @@ int TSet_SetUp(int socket_fd)
         */
         send_all(socket_fd, (unsigned char*)&n_row_ids, sizeof(n_row_ids));
 
-        ss.clear();
-        ss.seekg(0);
-
         tw_local = TW;
 
         N_words = (n_row_ids/N_threads) + ((n_row_ids%N_threads==0)?0:1);
 
-        AESENC(stag,W,KT);
+        AESENC(stag,(unsigned char*)W,KT);
 
         //Fill stagi array
         stagi_local = stagi;
@@ -1347,31 +828,10 @@ int TSet_SetUp(int socket_fd)
         stagi_local = stagi;
 
         //PRF of stag and if
-        stagi_local = stagi;
-        hashin_local = hashin;
-        for(int nword = 0;nword < N_words;++nword){
-            FPGA_AES_ENC(stagi_local,stag,hashin_local);
-            stagi_local += sym_block_size;
-            hashin_local += sym_block_size;
-        }
-        stagi_local = stagi;
-        hashin_local = hashin;
+        FPGA_AES_ENC(stagi,stag,hashin,N_words*N_threads);
 
         //Compute Hash
-        hashin_local = hashin;
-        hashout_local = hashout;
-        for(int nword = 0;nword < N_words;++nword){
-            FPGA_HASH(hashin_local,hashout_local);
-            hashin_local += sym_block_size;
-            hashout_local += hash_block_size;
-        }
-        hashin_local = hashin;
-        hashout_local = hashout;
-
-        //Should be done for each stag
-        for(int bc=0;bc<len_freeb;++bc){
-            FreeB[bc] = 0;
-        }
+        FPGA_HASH(hashin,hashout,N_words*N_threads);
 
         tw_local = TW;
         
@@ -1392,32 +852,39 @@ int TSet_SetUp(int socket_fd)
             TJIDX[0] =  bidx & 0xFF;
             TJIDX[1] =  (bidx >> 8) & 0xFF;
 
-            db_in_key.clear();
-            db_in_val.clear();
-            db_in_key = HexToStr(TBIDX,2) + HexToStr(TJIDX,2) + HexToStr(TLBL,12);
-            db_in_val = HexToStr(TVAL,49);
-            // redis.set(db_in_key.data(), db_in_val.data());
-            /*
-            
-            send the key, value pair to server, who would write them to its redis db
+            trow_local = TROW + (TSET_ENTRY_LEN*i);
+            ::memcpy(trow_local,TBIDX,2);
+            ::memcpy(trow_local+2,TJIDX,2);
+            ::memcpy(trow_local+4,TLBL,12);
+            ::memcpy(trow_local+TSET_KEY_LEN,TVAL,TSET_VAL_LEN);
 
-            */
-            send_all(socket_fd, (unsigned char*)db_in_key.data(), 32);
-            send_all(socket_fd, (unsigned char*)db_in_val.data(), 98);
             tw_local += 48;
             total_count++;
         }
+
+        //Counters start over for each stag, only the buckets of this row were touched
+        for(int i=0;i<n_row_ids;++i){
+            FreeB[(hashout[(64*i)+1] << 8) + hashout[64*i]] = 0;
+        }
+
+        /*
+
+        send the whole row of raw key, value pairs to server, who would bulk load them into its redis db
+
+        */
+        send_all(socket_fd, TROW, TSET_ENTRY_LEN*n_row_ids);
     }
     
     std::cout << "Total ID Count: " << total_count << std::endl;
 
-    delete [] TW;
-    delete [] W;
+    EIdx_ReaderClose(&eidx_reader);
+
     delete [] stag;
     delete [] stagi;
     delete [] stago;
     delete [] hashin;
     delete [] hashout;
+    delete [] TROW;
 
     delete [] FreeB;
 
@@ -1431,449 +898,92 @@ int TSet_GetTag(unsigned char *word, unsigned char *stag)
     return 0;
 }
 
-int TSet_Retrieve(unsigned char *stag,unsigned char *tset_row, int *n_ids_tset)
-{
-    unsigned char *stagi;
-    unsigned char *stago;
-    unsigned char *hashin;
-    unsigned char *hashout;
-    unsigned char *TV;
-    
-    int N_words = 0;
-    unsigned int N_max_id_words = 0;
-    
-    N_words = (N_max_ids/N_threads) + ((N_max_ids%N_threads==0)?0:1);
-    N_max_id_words = N_words * N_threads;
-
-    stagi = new unsigned char[16*N_max_id_words];
-    stago = new unsigned char[16*N_max_id_words];
-    hashin = new unsigned char[16*N_max_id_words];
-    hashout = new unsigned char[64*N_max_id_words];
-    TV = new unsigned char[48*N_max_id_words];
-
-    unsigned char TENTRY[61];
-    unsigned char TVAL[49];
-    unsigned char TBIDX[2];
-    unsigned char TJIDX[2];
-    unsigned char TLBL[12];
-    unsigned char HLBL[12];
-
-
-    unsigned int *FreeB;
-    int bidx=0;
-    int len_freeb = 65536;
-    int freeb_idx = 0;
-    bool BETA = 0;
-
-    unsigned char *stagi_local;
-    unsigned char *stago_local;
-    unsigned char *hashin_local;
-    unsigned char *hashout_local;
-
-    unsigned char * TV_curr;
-
-    unsigned char *T_RES;
-    unsigned char *T_BIDX;
-    unsigned char *T_JIDX;
-    unsigned char *T_LBL;
-
-    unsigned char *local_t_res;
-    unsigned char *local_t_bidx;
-    unsigned char *local_t_jidx;
-    unsigned char *local_t_lbl;
- 
-    unsigned char *local_t_res_word;
-    unsigned char *local_t_bidx_word;
-    unsigned char *local_t_jidx_word;
-    unsigned char *local_t_lbl_word;
-    unsigned char *local_hashout_word;
-
-    T_RES = new unsigned char[49*N_max_id_words];
-    T_BIDX = new unsigned char[2*N_max_id_words];
-    T_JIDX = new unsigned char[2*N_max_id_words];
-    T_LBL = new unsigned char[12*N_max_id_words];
-
-    int rcnt = 0;
-
-    ::memset(stagi,0x00,16*N_max_id_words);
-    ::memset(stago,0x00,16*N_max_id_words);
-    ::memset(hashin,0x00,16*N_max_id_words);
-    ::memset(hashout,0x00,64*N_max_id_words);
-    ::memset(TV,0x00,48*N_max_id_words);
-
-    ::memset(TVAL,0x00,49);
-    ::memset(TJIDX,0x00,2);
-
-    FreeB = new unsigned int[len_freeb];
-
-    for(int bc=0;bc<len_freeb;++bc){
-        FreeB[bc] = 0;
-    }
-
-    //Fill stagi array
-    stagi_local = stagi;
-    for(int nword = 0;nword < N_words;++nword){
-        for(int nid=0;nid<N_threads;++nid){
-            stagi_local[0] = ((nword*N_threads)+nid) & 0xFF;
-            stagi_local += 16;
-        }
-    }
-    stagi_local = stagi;
-
-    //PRF of stag and if
-    stagi_local = stagi;
-    hashin_local = hashin;
-    for(int nword = 0;nword < N_words;++nword){
-        FPGA_AES_ENC(stagi_local,stag,hashin_local);
-        stagi_local += sym_block_size;
-        hashin_local += sym_block_size;
-    }
-    stagi_local = stagi;
-    hashin_local = hashin;
-
-    //Compute Hash
-    hashin_local = hashin;
-    hashout_local = hashout;
-    for(int nword = 0;nword < N_words;++nword){
-        FPGA_HASH(hashin_local,hashout_local);
-        hashin_local += sym_block_size;
-        hashout_local += hash_block_size;
-    }
-    hashin_local = hashin;
-    hashout_local = hashout;
-
-    TV_curr = TV;
-
-    ::memset(T_RES,0x00,49*N_max_id_words);
-    ::memset(T_BIDX,0x00,2*N_max_id_words);
-    ::memset(T_JIDX,0x00,2*N_max_id_words);
-    ::memset(T_LBL,0x00,12*N_max_id_words);
-
-    local_t_res = T_RES;
-    local_t_bidx = T_BIDX;
-    local_t_jidx = T_JIDX;
-    local_t_lbl = T_LBL;
-    
-    while(!BETA){
-
-      local_hashout_word = hashout_local;
-      
-      local_t_res_word = local_t_res;
-      local_t_bidx_word = local_t_bidx;
-      local_t_jidx_word = local_t_jidx;
-      local_t_lbl_word = local_t_lbl;
-
-      for(unsigned int ni=0;ni<N_threads;++ni){
-          ::memcpy(local_t_bidx,hashout_local,2);
-
-          freeb_idx = ((local_t_bidx[1] << 8) + local_t_bidx[0]);
-
-          bidx = (FreeB[freeb_idx]++);
-          local_t_jidx[0] =  bidx & 0xFF;
-          local_t_jidx[1] =  (bidx >> 8) & 0xFF;
-
-          ::memcpy(local_t_lbl,hashout_local+2,12);
-          
-          local_t_bidx += 2;
-          local_t_jidx += 2;
-          local_t_lbl += 12;
-          hashout_local +=64;
-      }
-      
-      MGDB_QUERY(local_t_res,local_t_bidx_word,local_t_jidx_word,local_t_lbl_word);
-      
-      for(unsigned int ni=0;ni<N_threads;++ni){
-          ::memcpy(TVAL,local_t_res,49);
-          BETA = TVAL[0] ^ local_hashout_word[15];
-
-          for(int i=0;i<48;++i){
-              TV_curr[i] = local_hashout_word[16+i] ^ TVAL[i+1];
-          }
-
-          rcnt++;
-          if(BETA == 0x01) break;
-
-          TV_curr += 48;
-          local_t_res += 49;
-
-          local_hashout_word += 64;
-      }
-    }
-    
-    *n_ids_tset = rcnt;
-
-    ::memcpy(tset_row,TV,48*rcnt);
-
-    delete [] stagi;
-    delete [] stago;
-    delete [] hashin;
-    delete [] hashout;
-    delete [] TV;
-
-    delete [] FreeB;
-
-    delete [] T_RES;
-    delete [] T_BIDX;
-    delete [] T_JIDX;
-    delete [] T_LBL;
-
-    return 0;
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 
-int FPGA_AES_ENC(unsigned char *ptext,unsigned char *key, unsigned char *ctext)
+//The key is expanded once per batch and the schedule shared by all chunks
+int FPGA_AES_ENC(unsigned char *ptext,unsigned char *key, unsigned char *ctext, unsigned int n)
 {
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        ::memset(GL_AES_CT,0x00,sym_block_size);
-        ::memcpy(GL_AES_PT,ptext,sym_block_size);
-        ::memcpy(GL_AES_KT,key,16);
-
-        *GL_OPCODE = 1;
+    AESKeySchedule ks;
+    AES_LoadKeyEncOnly(&ks,key);
+    const AESKeySchedule *ks_ptr = &ks;
 
-        nWorkerCount = N_threads;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lock(mrun);
-        workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
-
-    *GL_OPCODE = 0;
-
-    ::memcpy(ctext,GL_AES_CT,sym_block_size);
+    TaskEngine_Run(n, TaskEngine_Grain(n,32), [=](size_t begin, size_t end){
+        AESENC_N(ks_ptr,ctext+(16*begin),ptext+(16*begin),end-begin);
+    });
 
     return 0;
 }
 
-int FPGA_PRF(unsigned char *ptext,unsigned char *key, unsigned char *ctext)
+//The PRF is AES under the PRF key
+int FPGA_PRF(unsigned char *ptext,unsigned char *key, unsigned char *ctext, unsigned int n)
 {
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        ::memset(GL_AES_CT,0x00,sym_block_size);
-        ::memcpy(GL_AES_PT,ptext,sym_block_size);
-        ::memcpy(GL_AES_KT,key,16);
-
-        *GL_OPCODE = 9;
-
-        nWorkerCount = N_threads;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lock(mrun);
-        workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
-
-    *GL_OPCODE = 0;
-
-    ::memcpy(ctext,GL_AES_CT,sym_block_size);
-
-    return 0;
+    return FPGA_AES_ENC(ptext,key,ctext,n);
 }
 
-int FPGA_HASH(unsigned char *msg, unsigned char *digest)
+int FPGA_HASH(unsigned char *msg, unsigned char *digest, unsigned int n)
 {
-
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        ::memset(GL_HASH_DGST,0x00,hash_block_size);
-        ::memcpy(GL_HASH_MSG,msg,sym_block_size);
-
-        *GL_OPCODE = 2;
-
-        nWorkerCount = N_threads;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lock(mrun);
-        workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
-
-    *GL_OPCODE = 0;
-
-    ::memcpy(digest,GL_HASH_DGST,hash_block_size);
+    TaskEngine_Run(n, TaskEngine_Grain(n,80), [=](size_t begin, size_t end){
+        ::memset(digest+(64*begin),0x00,64*(end-begin));
+        Blake3_Many(digest+(64*begin),64,msg+(16*begin),16,16,end-begin);
+    });
 
     return 0;
 }
 
-int FPGA_BLOOM_HASH(unsigned char *msg, unsigned char *digest)
+//Produces N_HASH digests per message: digest[(m*N_HASH)+j] = H(msg[m] || j)
+int FPGA_BLOOM_HASH(unsigned char *msg, unsigned char *digest, unsigned int n)
 {
-
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        ::memset(GL_BLM_MSG,0x00,bhash_in_block_size);
-        ::memset(GL_BLM_DGST,0x00,hash_block_size);
-        for(int i=0;i<N_HASH;i++){ //keep this operation here
-            ::memcpy(GL_BLM_MSG+(40*i),msg,32);
-            GL_BLM_MSG[40*i+39] = (i & 0xFF);
+    //The N_HASH messages of one xtag are hashed together, one per SIMD lane
+    TaskEngine_Run(n, TaskEngine_Grain(n,104*N_HASH), [=](size_t begin, size_t end){
+        unsigned char blm_msg[40*N_HASH];
+        ::memset(blm_msg,0x00,40*N_HASH);
+        for(size_t m=begin;m<end;++m){
+            for(int j=0;j<N_HASH;++j){
+                ::memcpy(blm_msg+(40*j),msg+(32*m),32);
+                blm_msg[(40*j)+39] = (j & 0xFF);
+            }
+            ::memset(digest+(64*N_HASH*m),0x00,64*N_HASH);
+            Blake3_Many(digest+(64*N_HASH*m),64,blm_msg,40,40,N_HASH);
         }
-
-        *GL_OPCODE = 3;
-
-        nWorkerCount = N_threads;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lock(mrun);
-        workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
-
-    *GL_OPCODE = 0;
-
-    ::memcpy(digest,GL_BLM_DGST,hash_block_size);
+    });
 
     return 0;
 }
 
-int FPGA_ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx)
+//A batch inversion costs one exponentiation plus three multiplications per element,
+//far less than one exponentiation per element on every worker
+int FPGA_ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx, unsigned int n)
 {
-
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        ::memset(GL_ECC_INVP,0x00,ecc_block_size);
-        ::memcpy(GL_ECC_INVA,fp_x,ecc_block_size);
-
-        *GL_OPCODE = 5;
-
-        nWorkerCount = N_threads;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lock(mrun);
-        workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
-
-    *GL_OPCODE = 0;
-
-    ::memcpy(fp_invx,GL_ECC_INVP,ecc_block_size);
-
+    ECC_FPINV_N(fp_x,fp_invx,n);
     return 0;
 }
 
-int FPGA_ECC_MUL(unsigned char *in_A,unsigned char *in_B,unsigned char *prod)
-{
-
-      {
-          std::lock_guard<std::mutex> lock(mrun);
-          ::memset(GL_ECC_PRD,0x00,ecc_block_size);
-          ::memcpy(GL_ECC_INA,in_A,ecc_block_size);
-          ::memcpy(GL_ECC_INB,in_B,ecc_block_size);
-
-          *GL_OPCODE = 4;
-
-          nWorkerCount = N_threads;
-          ++nCurrentIteration;
-      }
-      dataReady.notify_all();
-
-      {
-          std::unique_lock<std::mutex> lock(mrun);
-          workComplete.wait(lock, [] { return nWorkerCount == 0; });
-      }
-
-      *GL_OPCODE = 0;
-
-      ::memcpy(prod,GL_ECC_PRD,ecc_block_size);
-
-      return 0;
-}
-
-int FPGA_ECC_SCAMUL(unsigned char *sca, unsigned char *prod)
+int FPGA_ECC_MUL(unsigned char *in_A,unsigned char *in_B,unsigned char *prod, unsigned int n)
 {
-
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        ::memset(GL_ECC_SMP,0x00,ecc_block_size);
-        ::memcpy(GL_ECC_SCA,sca,ecc_block_size);
-
-        *GL_OPCODE = 6;
-
-        nWorkerCount = N_threads;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lock(mrun);
-        workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
-
-    *GL_OPCODE = 0;
-
-    ::memcpy(prod,GL_ECC_SMP,ecc_block_size);
+    TaskEngine_Run(n, TaskEngine_Grain(n,96), [=](size_t begin, size_t end){
+        ECC_MUL_N(in_A+(32*begin),in_B+(32*begin),prod+(32*begin),end-begin);
+    });
 
     return 0;
 }
 
-int FPGA_ECC_SCAMUL_BASE(unsigned char *sca, unsigned char *basep, unsigned char *prod)
+//g^x for the fixed generator ecc_basep (u = 9), served from the precomputed base table
+int FPGA_ECC_SCAMUL(unsigned char *sca, unsigned char *prod, unsigned int n)
 {
-
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        ::memset(GL_ECC_SMP,0x00,ecc_block_size);
-        ::memcpy(GL_ECC_SCA,sca,ecc_block_size);
-        ::memcpy(GL_ECC_BP,basep,ecc_block_size);
-
-        *GL_OPCODE = 7;
-
-        nWorkerCount = N_threads;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lock(mrun);
-        workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
-
-    *GL_OPCODE = 0;
-
-    ::memcpy(prod,GL_ECC_SMP,ecc_block_size);
+    TaskEngine_Run(n, TaskEngine_Grain(n,64), [=](size_t begin, size_t end){
+        ScalarMulBase_N(prod+(32*begin),sca+(32*begin),end-begin);
+    });
 
     return 0;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-int MGDB_QUERY(unsigned char *RES, unsigned char *BIDX, unsigned char *JIDX, unsigned char *LBL)
+int FPGA_ECC_SCAMUL_BASE(unsigned char *sca, unsigned char *basep, unsigned char *prod, unsigned int n)
 {
-    {
-        std::lock_guard<std::mutex> lock(mrun);
-        ::memcpy(GL_MGDB_BIDX,BIDX,(N_threads * 2));
-        ::memcpy(GL_MGDB_JIDX,JIDX,(N_threads * 2));
-        ::memcpy(GL_MGDB_LBL,LBL,(N_threads * 12));
-        ::memset(GL_MGDB_RES,0x00,(N_threads * 49));
-        
-//        for(unsigned int i=0;i<N_threads;++i){
-//            std::cout << MDB_HexToStr(LBL+(12*i),12) << std::endl;
-//        }
-
-        *GL_OPCODE = 8;
-
-        nWorkerCount = N_threads;
-        ++nCurrentIteration;
-    }
-    dataReady.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lock(mrun);
-        workComplete.wait(lock, [] { return nWorkerCount == 0; });
-    }
-
-    *GL_OPCODE = 0;
-
-    ::memcpy(RES,GL_MGDB_RES,(N_threads*49));
+    TaskEngine_Run(n, TaskEngine_Grain(n,96), [=](size_t begin, size_t end){
+        for(size_t i=begin;i<end;++i){
+            ScalarMul(prod+(32*i),sca+(32*i),basep+(32*i));
+        }
+    });
 
     return 0;
 }
@@ -1892,26 +1002,79 @@ int SHA3_HASH_K(blake3_hasher *hasher,unsigned char *msg, unsigned char *digest)
     return 0;
 }
 
+//Big-endian 32 byte encoding of v < 2^256, zero padded on the left
+static int ECC_Export32(unsigned char *out, const mpz_class &v)
+{
+    size_t count = 0;
+    unsigned char buf[32];
+    mpz_export(buf,&count,1,1,0,0,v.get_mpz_t());
+    ::memset(out,0x00,32-count);
+    ::memcpy(out+(32-count),buf,count);
+    return 0;
+}
+
 int ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx)
 {
     mpz_class a, b;
-    size_t ss = 32;
     mpz_import(a.get_mpz_t(),32,1,1,0,0,fp_x);
     mpz_powm(b.get_mpz_t(),a.get_mpz_t(),InvExp.get_mpz_t(),Prime.get_mpz_t());
-    StrToHex(fp_invx,b.get_str(16));
+    ECC_Export32(fp_invx,b);
+    return 0;
+}
+
+//Montgomery's trick: prefix products, one exponentiation for the inverse of the
+//whole product, then a backward pass peels off one element per two multiplications.
+//Zero elements are left out of the product and map to zero, like ECC_FPINV.
+int ECC_FPINV_N(unsigned char *fp_x, unsigned char *fp_invx, unsigned int n)
+{
+    std::vector<mpz_class> x(n), prefix(n);
+    mpz_class acc = 1, inv, t;
+
+    for(unsigned int i=0;i<n;++i){
+        mpz_import(x[i].get_mpz_t(),32,1,1,0,0,fp_x+(32*i));
+        if(x[i] >= Prime) mpz_mod(x[i].get_mpz_t(),x[i].get_mpz_t(),Prime.get_mpz_t());
+        prefix[i] = acc;//product of the nonzero elements before i
+        if(x[i] != 0){
+            mpz_mul(t.get_mpz_t(),acc.get_mpz_t(),x[i].get_mpz_t());
+            mpz_mod(acc.get_mpz_t(),t.get_mpz_t(),Prime.get_mpz_t());
+        }
+    }
+
+    mpz_powm(inv.get_mpz_t(),acc.get_mpz_t(),InvExp.get_mpz_t(),Prime.get_mpz_t());
+
+    for(unsigned int i=n;i-->0;){
+        if(x[i] == 0){
+            ::memset(fp_invx+(32*i),0x00,32);
+            continue;
+        }
+        //inv is now the inverse of the product of the nonzero elements up to i
+        mpz_mul(t.get_mpz_t(),inv.get_mpz_t(),prefix[i].get_mpz_t());
+        mpz_mod(t.get_mpz_t(),t.get_mpz_t(),Prime.get_mpz_t());
+        ECC_Export32(fp_invx+(32*i),t);
+        mpz_mul(t.get_mpz_t(),inv.get_mpz_t(),x[i].get_mpz_t());
+        mpz_mod(inv.get_mpz_t(),t.get_mpz_t(),Prime.get_mpz_t());
+    }
+
     return 0;
 }
 
 int ECC_MUL(unsigned char *in_A,unsigned char *in_B,unsigned char *prod)
 {
-    mpz_class a, b, c, r;
-    size_t ss = 32;
-
-    mpz_import(a.get_mpz_t(),32,1,1,0,0,in_A);
-    mpz_import(b.get_mpz_t(),32,1,1,0,0,in_B);
-    r = a * b;
-    mpz_mod(c.get_mpz_t(),r.get_mpz_t(),Prime.get_mpz_t());
-    StrToHex(prod,c.get_str(16));
+    return ECC_MUL_N(in_A,in_B,prod,1);
+}
+
+//Products mod Prime of n operand pairs, the mpz temporaries are allocated once per call
+int ECC_MUL_N(unsigned char *in_A,unsigned char *in_B,unsigned char *prod, unsigned int n)
+{
+    mpz_class a, b, r;
+
+    for(unsigned int i=0;i<n;++i){
+        mpz_import(a.get_mpz_t(),32,1,1,0,0,in_A+(32*i));
+        mpz_import(b.get_mpz_t(),32,1,1,0,0,in_B+(32*i));
+        mpz_mul(r.get_mpz_t(),a.get_mpz_t(),b.get_mpz_t());
+        mpz_mod(r.get_mpz_t(),r.get_mpz_t(),Prime.get_mpz_t());
+        ECC_Export32(prod+(32*i),r);
+    }
     return 0;
 }
 
@@ -1939,7 +1102,7 @@ int StrToHex(unsigned char *hexarr,string numin)
 {
     std::string dest = std::string( 64-numin.length(), '0').append( numin);
     const char *text = dest.data();
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<32; j++)
     {
         temp[0] = text[2*j];
@@ -1952,7 +1115,7 @@ int StrToHex(unsigned char *hexarr,string numin)
 int StrToHexBVec(unsigned char *hexarr,string bvec)
 {
     const char *text = bvec.data();
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<4; j++)
     {
         temp[0] = text[2*j];
@@ -37,18 +37,25 @@
 #include "rawdatautil.h"
 #include "ecc_x25519.h"
 #include "bloom_filter.h"
+#include "eidx_file.h"
+#include "widx_db.h"
+#include "task_engine.h"
+#include "search_protocol.h"
 #include "./blake3/blake3.h" 
 #include "./blake3/blake_hash.h"
 
-#include <sw/redis++/redis++.h>
-#include <sw/redis++/connection.h>
-#include <sw/redis++/redis_cluster.h>
-
 using namespace std;
-using namespace sw::redis;
 
-extern sw::redis::ConnectionOptions connection_options;
-extern sw::redis::ConnectionPoolOptions pool_options;
+//TSet entries are sent to the server as raw bytes: key = bidx(2) || jidx(2) || label(12), value = beta || e,y (49)
+#define TSET_KEY_LEN 16
+#define TSET_VAL_LEN 49
+#define TSET_ENTRY_LEN (TSET_KEY_LEN + TSET_VAL_LEN)
+//Counters per window of the xtoken message, each window is sent once it is computed
+#define SEARCH_XTOKEN_WINDOW 64
+//EDB_SetUp schedules (keyword, id range) tasks of at most EDB_TASK_IDS ids, for
+//batches of rows holding about EDB_BATCH_IDS ids
+#define EDB_TASK_IDS 64
+#define EDB_BATCH_IDS (1 << 16)
 
 extern string widxdb_file;
 extern string eidxdb_file;
@@ -71,107 +78,48 @@ extern unsigned char KZ[16];
 extern unsigned char KX[16];
 extern unsigned char KT[16];
 
-extern unsigned char **BF;
+extern unsigned char *BF;
 extern unsigned char *UIDX;
 
 extern unsigned int N_threads;
 
-extern unsigned char *GL_AES_PT;
-extern unsigned char *GL_AES_KT;
-extern unsigned char *GL_AES_CT;
-
-extern unsigned char *GL_ECC_INVA;
-extern unsigned char *GL_ECC_INVP;
-
-extern unsigned char *GL_ECC_SCA;
-extern unsigned char *GL_ECC_BP;
-extern unsigned char *GL_ECC_SMP;
-
-extern unsigned char *GL_ECC_INA;
-extern unsigned char *GL_ECC_INB;
-extern unsigned char *GL_ECC_PRD;
-
-extern unsigned char *GL_HASH_MSG;
-extern unsigned char *GL_HASH_DGST;
-
-extern unsigned char *GL_BLM_MSG;
-extern unsigned char *GL_BLM_DGST;
-
-extern unsigned char *GL_MGDB_RES;
-extern unsigned char *GL_MGDB_BIDX;
-extern unsigned char *GL_MGDB_JIDX;
-extern unsigned char *GL_MGDB_LBL;
-
-extern unsigned int *GL_OPCODE;
-
-extern std::mutex mrun;
-extern std::condition_variable dataReady;
-extern std::condition_variable workComplete;
-
-extern bool ready;
-extern bool processed;
-
-extern size_t nWorkerCount;//Number of threads
-extern int nCurrentIteration;
-
-extern std::vector<thread> thread_pool;
-
 int Sys_Init();
 int Sys_Clear();
 
 int SetUpThreads();
 int ReleaseThreads();
 
+int Msg_Send(int sockfd, uint8_t type, uint32_t request_id, const unsigned char *payload, uint64_t length);
+int Msg_SendHeader(int sockfd, uint8_t type, uint32_t request_id, uint64_t length);
+int Msg_Recv(int sockfd, MsgHeader *hdr, std::vector<unsigned char> &payload, uint64_t max_len);
+
 int send_file(int sockfd, const char* filename);
 int receive_file(int sockfd, const char* filename);
 
-int WorkerThread(
-    unsigned char *AES_PT,
-    unsigned char *AES_KT,
-    unsigned char *AES_CT,
-    unsigned char *ECC_INVA,
-    unsigned char *ECC_INVP,
-    unsigned char *ECC_SCA,
-    unsigned char *ECC_BP,
-    unsigned char *ECC_SMP,
-    unsigned char *ECC_INA,
-    unsigned char *ECC_INB,
-    unsigned char *ECC_PRD,
-    unsigned char *HASH_MSG,
-    unsigned char *HASH_DGST,
-    unsigned char *BLM_MSG,
-    unsigned char *BLM_DGST,
-    unsigned char *MGDB_RES,
-    unsigned char *MGDB_BIDX,
-    unsigned char *MGDB_JIDX,
-    unsigned char *MGDB_LBL,
-    unsigned int *OPCODE
-);
-
 int TSet_SetUp(int socket_fd);
 int TSet_GetTag(unsigned char *word,unsigned char *stag);
-int TSet_Retrieve(unsigned char *stag,unsigned char *tset_row, int *n_ids_tset);
 
 int EDB_SetUp(int socket_fd);
 int EDB_Search(unsigned char *query_str, int NWords, int socket_fd);
 
-int FPGA_AES_ENC(unsigned char *ptext,unsigned char *key, unsigned char *ctext);
-int FPGA_PRF(unsigned char *ptext,unsigned char *key, unsigned char *ctext);
-
-int FPGA_HASH(unsigned char *msg, unsigned char *digest);
-int FPGA_BLOOM_HASH(unsigned char *msg, unsigned char *digest);
+//Batched primitives: each call processes n items in one task engine submission
+int FPGA_AES_ENC(unsigned char *ptext,unsigned char *key, unsigned char *ctext, unsigned int n);
+int FPGA_PRF(unsigned char *ptext,unsigned char *key, unsigned char *ctext, unsigned int n);
 
-int FPGA_ECC_MUL(unsigned char *in_A, unsigned char *in_B, unsigned char *prod);
-int FPGA_ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx);
-int FPGA_ECC_SCAMUL(unsigned char *sca, unsigned char *prod);
-int FPGA_ECC_SCAMUL_BASE(unsigned char *sca, unsigned char *basep, unsigned char *prod);
+int FPGA_HASH(unsigned char *msg, unsigned char *digest, unsigned int n);
+int FPGA_BLOOM_HASH(unsigned char *msg, unsigned char *digest, unsigned int n);
 
-int MGDB_QUERY(unsigned char *RES, unsigned char *BIDX, unsigned char *JIDX, unsigned char *LBL);
+int FPGA_ECC_MUL(unsigned char *in_A, unsigned char *in_B, unsigned char *prod, unsigned int n);
+int FPGA_ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx, unsigned int n);
+int FPGA_ECC_SCAMUL(unsigned char *sca, unsigned char *prod, unsigned int n);
+int FPGA_ECC_SCAMUL_BASE(unsigned char *sca, unsigned char *basep, unsigned char *prod, unsigned int n);
 
 int SHA3_HASH(blake3_hasher *hasher,unsigned char *msg, unsigned char *digest);
 int SHA3_HASH_K(blake3_hasher *hasher,unsigned char *msg, unsigned char *digest);
 int ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx);
+int ECC_FPINV_N(unsigned char *fp_x, unsigned char *fp_invx, unsigned int n);
 int ECC_MUL(unsigned char *in_A,unsigned char *in_B,unsigned char *prod);
+int ECC_MUL_N(unsigned char *in_A,unsigned char *in_B,unsigned char *prod, unsigned int n);
 
 std::string HexToStr(unsigned char *hexarr,int len=16);
 std::string NumToHexStr(int num);
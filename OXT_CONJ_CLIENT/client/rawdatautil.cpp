@@ -2,7 +2,7 @@
 
 int DB_StrToHex2(unsigned char *hexarr,unsigned char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     temp[0] = text[0];
     temp[1] = text[1];
     hexarr[0] = ::strtoul(temp,nullptr,16) & 0xFF;
@@ -11,7 +11,7 @@ int DB_StrToHex2(unsigned char *hexarr,unsigned char *text)
 
 int DB_StrToHex(unsigned char *hexarr,unsigned char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<2; j++)
     {
         temp[0] = text[2*j];
@@ -23,7 +23,7 @@ int DB_StrToHex(unsigned char *hexarr,unsigned char *text)
 
 int DB_StrToHex8(unsigned char *hexarr,unsigned char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<4; j++)
     {
         temp[0] = text[2*j];
@@ -35,7 +35,7 @@ int DB_StrToHex8(unsigned char *hexarr,unsigned char *text)
 
 int DB_StrToHex8(unsigned char *hexarr,const char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<4; j++)
     {
         temp[0] = text[2*j];
@@ -47,7 +47,7 @@ int DB_StrToHex8(unsigned char *hexarr,const char *text)
 
 int DB_StrToHex12(unsigned char *hexarr,unsigned char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<12; j++)
     {
         temp[0] = text[2*j];
@@ -59,7 +59,7 @@ int DB_StrToHex12(unsigned char *hexarr,unsigned char *text)
 
 int DB_StrToHex16(unsigned char *hexarr,unsigned char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<16; j++)
     {
         temp[0] = text[2*j];
@@ -71,7 +71,7 @@ int DB_StrToHex16(unsigned char *hexarr,unsigned char *text)
 
 int DB_StrToHex32(unsigned char *hexarr,unsigned char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<32; j++)
     {
         temp[0] = text[2*j];
@@ -83,7 +83,7 @@ int DB_StrToHex32(unsigned char *hexarr,unsigned char *text)
 
 int DB_StrToHex49(unsigned char *hexarr,unsigned char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<49; j++)
     {
         temp[0] = text[2*j];
@@ -95,7 +95,7 @@ int DB_StrToHex49(unsigned char *hexarr,unsigned char *text)
 
 int DB_StrToHex48(unsigned char *hexarr,const char *text)
 {
-    char temp[2];
+    char temp[3] = {0,0,0};
     for (int j=0; j<48; j++)
     {
         temp[0] = text[2*j];
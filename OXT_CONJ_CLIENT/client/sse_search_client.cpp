@@ -19,6 +19,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 
@@ -33,63 +34,20 @@ int N_max_ids = 0; // Maximum number of ids for a kw -- or maximum frequency of
 int N_row_ids = N_max_ids;
 
 string widxdb_file = "../databases/db6k.csv";//Raw enron database
-string eidxdb_file = "eidxdb.csv";//Encrypted meta-keyword database
+string eidxdb_file = "eidxdb.bin";//Encrypted meta-keyword database (eidx_file.h)
 string bloomfilter_file = "bloom_filter.dat";//Bloom filter file
 
-sw::redis::ConnectionOptions connection_options;
-sw::redis::ConnectionPoolOptions pool_options;
-
 mpz_class Prime{"7237005577332262213973186563042994240857116359379907606001950938285454250989",10};//Curve25519 curve order
 mpz_class InvExp{"7237005577332262213973186563042994240857116359379907606001950938285454250987",10};
 
 unsigned char ecc_basep[32] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x09};
 
-unsigned char **BF;
+unsigned char *BF;
 
 unsigned char *UIDX;
 
-unsigned char *GL_AES_PT;
-unsigned char *GL_AES_KT;
-unsigned char *GL_AES_CT;
-
-unsigned char *GL_ECC_INVA;
-unsigned char *GL_ECC_INVP;
-
-unsigned char *GL_ECC_SCA;
-unsigned char *GL_ECC_BP;
-unsigned char *GL_ECC_SMP;
-
-unsigned char *GL_ECC_INA;
-unsigned char *GL_ECC_INB;
-unsigned char *GL_ECC_PRD;
-
-unsigned char *GL_HASH_MSG;
-unsigned char *GL_HASH_DGST;
-
-unsigned char *GL_BLM_MSG;
-unsigned char *GL_BLM_DGST;
-
-unsigned char *GL_MGDB_RES;
-unsigned char *GL_MGDB_BIDX;
-unsigned char *GL_MGDB_JIDX;
-unsigned char *GL_MGDB_LBL;
-
-unsigned int *GL_OPCODE;
-
 unsigned int N_threads = 16;
 
-std::mutex mrun;
-std::condition_variable dataReady;
-std::condition_variable workComplete;
-
-bool ready = false;
-bool processed = false;
-
-size_t nWorkerCount = N_threads; //Number of threads
-int nCurrentIteration = 0;
-
-std::vector<thread> thread_pool;
-
 int sym_block_size = 0;
 int ecc_block_size = 0;
 int hash_block_size = 0;
@@ -179,7 +137,6 @@ int ReadConfAll(std::string db_conf_filename)
 
         ///////////////////////////////////////////////////////////////////////
 
-        nWorkerCount = N_threads;
         N_row_ids = N_max_ids;
 
         sym_block_size = N_threads * 16;
@@ -291,7 +248,10 @@ int main()
     Sys_Init();
     
     std::cout << "Reading Bloom Filter from disk..." << std::endl;
-    BloomFilter_ReadBFfromFile(bloomfilter_file, BF); //Load bloom filter from file
+    if(BloomFilter_ReadBFfromFile(bloomfilter_file, BF) != 0){ //Map bloom filter from file
+        Sys_Clear();
+        exit(1);
+    }
     //----------------------------------------------------------------------------------------------
     // Search
     
@@ -309,13 +269,13 @@ int main()
     std::vector<unsigned int> freq_sorted;
     std::vector<std::string> kw_sorted;
 
-    unsigned int nm = 0;
+    int nm = 0;
     unsigned char row_vec[2048]; //16 bytes * Number of keywords in the query
     int n_vec = 0;
     std::set<std::string> result_temp;
 
     // Open input.txt once before the loop
-    std::ifstream conjunctive_input_file("/home/rounak/Documents/Sem10/Design_lab/TWINSSE/client/results/input.txt");
+    std::ifstream conjunctive_input_file("./results/input.txt");
     if (!conjunctive_input_file.is_open()) {
         std::cerr << "Failed to open input.txt" << std::endl;
         exit(1);
@@ -323,6 +283,30 @@ int main()
 
     std::string input_kw_pair_line; // unique name for input line string
 
+	/*
+	
+	create the socket and connect to server, all queries share this connection
+	
+	*/
+	if((sockfd=socket(AF_INET,SOCK_STREAM,0))<0){
+		perror("Socket cannot be opened\n");
+		exit(1);
+	}
+	serv_addr.sin_family = AF_INET;
+	inet_aton(s_ip,&serv_addr.sin_addr);
+	serv_addr.sin_port = htons(lport);
+
+	if(connect(sockfd,(struct sockaddr*)&serv_addr,sizeof(serv_addr))<0){
+		perror("Couldn't connect to server\n");
+		exit(1);
+	}
+    else{
+        cout << "Connection established with server ..." << endl;
+    }
+
+    int nodelay = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
     for(unsigned int q_idx=0;q_idx<n_iterations;++q_idx){
         query.clear();
         freq_map.clear();
@@ -383,51 +367,22 @@ int main()
         ::memset(UIDX,0x00,16*N_max_ids);
         result_temp.clear();
 
-		/*
-		
-		create the socket and connect to server
-		
-		*/
-		
-		if((sockfd=socket(AF_INET,SOCK_STREAM,0))<0){
-			perror("Socket cannot be opened\n");
-			exit(1);
-		}
-		serv_addr.sin_family = AF_INET;
-		inet_aton(s_ip,&serv_addr.sin_addr);
-		serv_addr.sin_port = htons(lport);
-
-		if(connect(sockfd,(struct sockaddr*)&serv_addr,sizeof(serv_addr))<0){
-			perror("Couldn't connect to server\n");
-			exit(1);
-		}
-        else{
-            cout << "Connection established with server ..." << endl;
-        }
-
         //-------------------------------------------------------------------------------
         search_start_time = std::chrono::high_resolution_clock::now();
 
-		/*
-		
-		add the socket argument to new EDB_Search, remember to create new mainwindow.h file with new fxn defn and include it in this file
-		
-		*/
         nm = EDB_Search(row_vec,(n_vec-1), sockfd);
 
         search_stop_time = std::chrono::high_resolution_clock::now();
         search_time_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(search_stop_time - search_start_time).count();
 
-        std::cout << "Search done!" << std::endl;
-		
-		/*
-		
-		close the socket
+        if(nm < 0){
+            std::cerr << "Search failed, the connection to the server is no longer usable" << std::endl;
+            break;
+        }
 
-		*/
-		close(sockfd);
+        std::cout << "Search done!" << std::endl;
 
-        for(unsigned int k=0;k<nm;++k){
+        for(int k=0;k<nm;++k){
             result_temp.insert(DB_HexToStr_N(UIDX+(16*k),16));
         }
         //-----------------------------------------------------------------------------
@@ -454,6 +409,13 @@ int main()
         cin.get();
     }
 
+	/*
+	
+	close the socket
+	
+	*/
+	close(sockfd);
+
     res_query_file_handle.close();
     res_id_file_handle.close();
     res_time_file_handle.close();
@@ -30,63 +30,20 @@ int N_max_ids = 0; // Maximum number of ids for a kw -- or maximum frequency of
 int N_row_ids = N_max_ids;
 
 string widxdb_file = "../databases/db6k.csv";//Raw enron database
-string eidxdb_file = "eidxdb.csv";//Encrypted meta-keyword database
+string eidxdb_file = "eidxdb.bin";//Encrypted meta-keyword database (eidx_file.h)
 string bloomfilter_file = "bloom_filter.dat";//Bloom filter file
 
-sw::redis::ConnectionOptions connection_options;
-sw::redis::ConnectionPoolOptions pool_options;
-
 mpz_class Prime{"7237005577332262213973186563042994240857116359379907606001950938285454250989",10};//Curve25519 curve order
 mpz_class InvExp{"7237005577332262213973186563042994240857116359379907606001950938285454250987",10};
 
 unsigned char ecc_basep[32] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x09};
 
-unsigned char **BF;
+unsigned char *BF;
 
 unsigned char *UIDX;
 
-unsigned char *GL_AES_PT;
-unsigned char *GL_AES_KT;
-unsigned char *GL_AES_CT;
-
-unsigned char *GL_ECC_INVA;
-unsigned char *GL_ECC_INVP;
-
-unsigned char *GL_ECC_SCA;
-unsigned char *GL_ECC_BP;
-unsigned char *GL_ECC_SMP;
-
-unsigned char *GL_ECC_INA;
-unsigned char *GL_ECC_INB;
-unsigned char *GL_ECC_PRD;
-
-unsigned char *GL_HASH_MSG;
-unsigned char *GL_HASH_DGST;
-
-unsigned char *GL_BLM_MSG;
-unsigned char *GL_BLM_DGST;
-
-unsigned char *GL_MGDB_RES;
-unsigned char *GL_MGDB_BIDX;
-unsigned char *GL_MGDB_JIDX;
-unsigned char *GL_MGDB_LBL;
-
-unsigned int *GL_OPCODE;
-
 unsigned int N_threads = 16;//Default number of threads to use
 
-std::mutex mrun;
-std::condition_variable dataReady;
-std::condition_variable workComplete;
-
-bool ready = false;
-bool processed = false;
-
-size_t nWorkerCount = N_threads; //Number of threads
-int nCurrentIteration = 0;
-
-std::vector<thread> thread_pool;
-
 int sym_block_size = 0;
 int ecc_block_size = 0;
 int hash_block_size = 0;
@@ -176,7 +133,6 @@ int ReadConfAll(std::string db_conf_filename)
 
         ///////////////////////////////////////////////////////////////////////
 
-        nWorkerCount = N_threads;
         N_row_ids = N_max_ids;
 
         sym_block_size = N_threads * 16;
@@ -205,8 +161,21 @@ int ReadConfAll(std::string db_conf_filename)
     return 0;
 }
 
-int main()
+//The Bloom filter is written after the encrypted index, so one left over from an
+//older run is caught by its modification time
+static bool ResumeFilesValid()
+{
+    struct stat st_eidx, st_bf;
+    if(::stat(eidxdb_file.data(),&st_eidx) < 0 || ::stat(bloomfilter_file.data(),&st_bf) < 0) return false;
+    return st_bf.st_mtime >= st_eidx.st_mtime;
+}
+
+//With --resume a complete eidxdb_file and bloomfilter_file from an earlier run are
+//reused: only the TSet is rebuilt and sent, the ECC work of EDB_SetUp is skipped
+int main(int argc, char **argv)
 {
+    bool resume = (argc > 1) && (::strcmp(argv[1],"--resume") == 0);
+
     // CONNECTION VARIABLES ----------------------------------------------------------------------------------------------
     int sockfd;
 	struct sockaddr_in serv_addr;
@@ -246,16 +215,41 @@ int main()
     ::memset(UIDX,0x00,16*N_max_ids);
 
     Sys_Init();
-    
-    EDB_SetUp(sockfd);
 
-    std::cout << "Writing Bloom Filter to disk..." << std::endl;
+    if(resume){
+        cout << "Resuming from " << eidxdb_file << " and " << bloomfilter_file << endl;
+        if(!ResumeFilesValid() || TSet_SetUp(sockfd) < 0){
+            cout << "Could not resume setup" << endl;
+            Sys_Clear();
+            delete [] UIDX;
+            close(sockfd);
+            return 1;
+        }
+    }
+    else{
+        if(EDB_SetUp(sockfd) < 0){
+            cout << "Setup failed" << endl;
+            Sys_Clear();
+            delete [] UIDX;
+            close(sockfd);
+            return 1;
+        }
+
+        std::cout << "Writing Bloom Filter to disk..." << std::endl;
+        if(BloomFilter_WriteBFtoFile(bloomfilter_file, BF) < 0){ //Store bloom filter in file
+            cout << "Setup failed" << endl;
+            Sys_Clear();
+            delete [] UIDX;
+            close(sockfd);
+            return 1;
+        }
+    }
+
     /*
     
     send BF over to server
     
     */
-    BloomFilter_WriteBFtoFile(bloomfilter_file, BF); //Store bloom filter in file
 
     send_file(sockfd, bloomfilter_file.data());
 
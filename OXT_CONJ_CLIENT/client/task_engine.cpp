@@ -0,0 +1,218 @@
+#include "task_engine.h"
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include <sched.h>
+#include <pthread.h>
+
+//Chunk size is capped so that the inputs and outputs of one chunk stay in L1
+#define TASK_CHUNK_BYTES 16384
+//Chunks per worker for a large submission, leaves room for stealing
+#define TASK_CHUNKS_PER_WORKER 4
+
+struct TaskJob {
+    const TaskBody *body;
+    std::atomic<size_t> pending;
+    std::mutex m;
+    std::condition_variable done;
+    bool finished;
+};
+
+struct TaskChunk {
+    TaskJob *job;
+    size_t begin;
+    size_t end;
+};
+
+struct TaskQueue {
+    std::mutex m;
+    std::deque<TaskChunk> chunks;
+};
+
+static std::vector<TaskQueue*> te_queues;
+static std::vector<std::thread> te_workers;
+
+static std::mutex te_idle_mutex;
+static std::condition_variable te_idle;
+static std::atomic<size_t> te_queued(0);
+static bool te_stop = false;
+
+static std::atomic<unsigned int> te_next_queue(0);
+
+//Set on the pool threads, a submission from inside a task runs inline instead of
+//waiting on chunks that only the blocked worker could drain
+static thread_local bool te_in_worker = false;
+
+static bool TaskEngine_Pop(unsigned int id, TaskChunk *chunk)
+{
+    {
+        std::lock_guard<std::mutex> lock(te_queues[id]->m);
+        if(!te_queues[id]->chunks.empty()){
+            *chunk = te_queues[id]->chunks.front();
+            te_queues[id]->chunks.pop_front();
+            return true;
+        }
+    }
+
+    //Own deque is empty, steal from the back of the others
+    unsigned int n_queues = te_queues.size();
+    for(unsigned int k=1;k<n_queues;++k){
+        TaskQueue *victim = te_queues[(id+k)%n_queues];
+        std::lock_guard<std::mutex> lock(victim->m);
+        if(!victim->chunks.empty()){
+            *chunk = victim->chunks.back();
+            victim->chunks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+static void TaskEngine_Finish(TaskJob *job)
+{
+    if(job->pending.fetch_sub(1) == 1){
+        std::lock_guard<std::mutex> lock(job->m);
+        job->finished = true;
+        job->done.notify_all();
+    }
+}
+
+static void TaskEngine_Worker(unsigned int id)
+{
+    TaskChunk chunk;
+
+    te_in_worker = true;
+
+    while(true){
+        if(TaskEngine_Pop(id,&chunk)){
+            --te_queued;
+            (*chunk.job->body)(chunk.begin,chunk.end);
+            TaskEngine_Finish(chunk.job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(te_idle_mutex);
+        te_idle.wait(lock, [] { return te_stop || te_queued.load() > 0; });
+        if(te_stop && te_queued.load() == 0) break;
+    }
+}
+
+int TaskEngine_Init(unsigned int n_workers)
+{
+    if(n_workers == 0) n_workers = 1;
+
+    te_stop = false;
+    te_queued = 0;
+
+    for(unsigned int i=0;i<n_workers;++i){
+        te_queues.push_back(new TaskQueue);
+    }
+
+    for(unsigned int i=0;i<n_workers;++i){
+        te_workers.push_back(std::thread(TaskEngine_Worker,i));
+    }
+
+    int rc = 0;
+    for(unsigned int i=0;i<n_workers;++i){
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(i, &cpuset);
+        rc = pthread_setaffinity_np(te_workers[i].native_handle(), sizeof(cpu_set_t), &cpuset);
+        if (rc != 0) {
+            std::cout << "Error calling pthread_setaffinity_np: " << rc << std::endl;
+        }
+    }
+
+    return 0;
+}
+
+int TaskEngine_Release()
+{
+    {
+        std::lock_guard<std::mutex> lock(te_idle_mutex);
+        te_stop = true;
+    }
+    te_idle.notify_all();
+
+    for(std::thread &worker : te_workers){
+        worker.join();
+    }
+    te_workers.clear();
+
+    for(TaskQueue *q : te_queues){
+        delete q;
+    }
+    te_queues.clear();
+
+    return 0;
+}
+
+unsigned int TaskEngine_Workers()
+{
+    return te_queues.size();
+}
+
+size_t TaskEngine_Grain(size_t n_items, size_t item_bytes)
+{
+    size_t n_split = TaskEngine_Workers() * TASK_CHUNKS_PER_WORKER;
+    size_t grain_cache = (item_bytes == 0) ? n_items : (TASK_CHUNK_BYTES / item_bytes);
+    size_t grain_split = (n_split == 0) ? n_items : ((n_items + n_split - 1) / n_split);
+
+    size_t grain = (grain_cache < grain_split) ? grain_cache : grain_split;
+    return (grain == 0) ? 1 : grain;
+}
+
+int TaskEngine_Run(size_t n_items, size_t grain, const TaskBody &body)
+{
+    if(n_items == 0) return 0;
+    if(grain == 0) grain = 1;
+
+    size_t n_chunks = (n_items + grain - 1) / grain;
+
+    //Not worth a round trip through the pool, or called from a task
+    if(n_chunks == 1 || te_queues.empty() || te_in_worker){
+        body(0,n_items);
+        return 0;
+    }
+
+    TaskJob job;
+    job.body = &body;
+    job.pending = n_chunks;
+    job.finished = false;
+
+    //Publish the count first so that a worker never sees it go below zero
+    {
+        std::lock_guard<std::mutex> lock(te_idle_mutex);
+        te_queued += n_chunks;
+    }
+
+    unsigned int n_queues = te_queues.size();
+    unsigned int q = te_next_queue.fetch_add(1) % n_queues;
+
+    for(size_t begin=0;begin<n_items;begin+=grain){
+        TaskChunk chunk;
+        chunk.job = &job;
+        chunk.begin = begin;
+        chunk.end = (begin + grain < n_items) ? (begin + grain) : n_items;
+        {
+            std::lock_guard<std::mutex> lock(te_queues[q]->m);
+            te_queues[q]->chunks.push_back(chunk);
+        }
+        q = (q + 1) % n_queues;
+    }
+
+    te_idle.notify_all();
+
+    {
+        std::unique_lock<std::mutex> lock(job.m);
+        job.done.wait(lock, [&job] { return job.finished; });
+    }
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include "widx_db.h"
+#include "task_engine.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Rows parsed by one chunk, merged into the CSR arrays afterwards
+struct WIdxChunk {
+    const char *begin;
+    const char *end;
+    std::vector<unsigned char> kw;
+    std::vector<uint32_t> row_ids;
+    std::vector<unsigned char> ids;
+};
+
+//Nibble value of every byte, non hex characters read as 0
+struct WIdxHexTable {
+    unsigned char v[256];
+    WIdxHexTable(){
+        ::memset(v,0x00,sizeof(v));
+        for(int c='0';c<='9';++c) v[c] = c - '0';
+        for(int c='a';c<='f';++c) v[c] = c - 'a' + 10;
+        for(int c='A';c<='F';++c) v[c] = c - 'A' + 10;
+    }
+};
+
+static const WIdxHexTable widx_hex;
+
+//4 bytes from the leading hex pairs of a field of len characters whose first (up to 8)
+//nibbles are in acc; missing pairs are zero filled like DB_StrToHex8
+static inline void WIdx_StoreField(unsigned char *out, uint32_t acc, uint32_t len)
+{
+    uint32_t n_nibbles = (len < 8) ? len : 8;
+    uint32_t n_pairs = n_nibbles / 2;
+    uint32_t value = (n_pairs == 0) ? 0 : ((acc >> (4 * (n_nibbles - (2 * n_pairs)))) << (8 * (4 - n_pairs)));
+
+    out[0] = (value >> 24) & 0xFF;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+//One scan over the characters of the chunk. The first comma terminated field of a row
+//is the keyword, every further non-empty comma terminated field an id.
+static void WIdx_ParseChunk(WIdxChunk *chunk)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(chunk->begin);
+    const unsigned char *end = reinterpret_cast<const unsigned char*>(chunk->end);
+
+    //An id field normally takes 9 bytes of text ("XXXXXXXX,"), grown on demand
+    size_t n_id_bytes = 0;
+    chunk->ids.resize((((end - p) / 9) + 1) * WIDX_ID_LEN);
+
+    uint32_t acc = 0, len = 0, n_ids = 0;
+    bool have_kw = false;
+    unsigned char field[4];
+
+    for(;p<=end;++p){
+        unsigned char c = (p < end) ? *p : '\n';
+
+        if(c == ','){
+            WIdx_StoreField(field,acc,len);
+            if(!have_kw){
+                chunk->kw.insert(chunk->kw.end(),field,field+4);
+                have_kw = true;
+            }
+            else if(len > 0){
+                if(n_id_bytes + WIDX_ID_LEN > chunk->ids.size()) chunk->ids.resize(2 * chunk->ids.size());
+                ::memcpy(chunk->ids.data()+n_id_bytes,field,4);
+                n_id_bytes += WIDX_ID_LEN;
+                n_ids++;
+            }
+            acc = 0;
+            len = 0;
+        }
+        else if(c == '\n'){
+            if(have_kw){
+                chunk->row_ids.push_back(n_ids);
+            }
+            else if(len > 0){
+                //A keyword without any id field still makes an (empty) row
+                WIdx_StoreField(field,acc,len);
+                chunk->kw.insert(chunk->kw.end(),field,field+4);
+                chunk->row_ids.push_back(0);
+            }
+            //Blank lines are skipped, a field without a trailing comma is not an id
+            acc = 0;
+            len = 0;
+            n_ids = 0;
+            have_kw = false;
+        }
+        else{
+            if(len < 8) acc = (acc << 4) | widx_hex.v[c];
+            len++;
+        }
+    }
+
+    chunk->ids.resize(n_id_bytes);
+}
+
+int WIdx_Load(WIdxDB *db, const std::string &widx_file)
+{
+    db->n_rows = 0;
+    db->n_ids = 0;
+    db->max_row_ids = 0;
+    db->kw.clear();
+    db->offsets.assign(1,0);
+    db->ids.clear();
+
+    int fd = ::open(widx_file.data(),O_RDONLY);
+    if(fd < 0){
+        std::cout << "Could not open " << widx_file << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if(::fstat(fd,&st) < 0){
+        std::cout << "Could not stat " << widx_file << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    size_t file_len = st.st_size;
+    if(file_len == 0){
+        ::close(fd);
+        return 0;
+    }
+
+    void *map = ::mmap(nullptr,file_len,PROT_READ,MAP_PRIVATE,fd,0);
+    ::close(fd);
+    if(map == MAP_FAILED){
+        std::cout << "Could not map " << widx_file << std::endl;
+        return -1;
+    }
+    ::madvise(map,file_len,MADV_SEQUENTIAL);
+
+    const char *text = static_cast<const char*>(map);
+    const char *text_end = text + file_len;
+
+    //Cut the text at row boundaries
+    size_t n_split = (size_t)TaskEngine_Workers() * 4;
+    size_t chunk_bytes = (n_split == 0) ? file_len : (file_len / n_split);
+    if(chunk_bytes < WIDX_MIN_CHUNK_BYTES) chunk_bytes = WIDX_MIN_CHUNK_BYTES;
+
+    std::vector<WIdxChunk> chunks;
+    const char *p = text;
+    while(p < text_end){
+        const char *cut = (text_end - p > (ptrdiff_t)chunk_bytes) ? (p + chunk_bytes) : text_end;
+        if(cut < text_end){
+            const char *eol = static_cast<const char*>(::memchr(cut,'\n',text_end-cut));
+            cut = (eol == nullptr) ? text_end : (eol + 1);
+        }
+        WIdxChunk chunk;
+        chunk.begin = p;
+        chunk.end = cut;
+        chunks.push_back(std::move(chunk));
+        p = cut;
+    }
+
+    WIdxChunk *chunk_ptr = chunks.data();
+    TaskEngine_Run(chunks.size(), 1, [=](size_t begin, size_t end){
+        for(size_t c=begin;c<end;++c){
+            WIdx_ParseChunk(chunk_ptr+c);
+        }
+    });
+
+    //Row and id bases of every chunk, then copy the chunks into place in parallel
+    std::vector<uint64_t> row_base(chunks.size()+1,0), id_base(chunks.size()+1,0);
+    for(size_t c=0;c<chunks.size();++c){
+        row_base[c+1] = row_base[c] + chunks[c].row_ids.size();
+        id_base[c+1] = id_base[c] + (chunks[c].ids.size() / WIDX_ID_LEN);
+    }
+
+    db->n_rows = (uint32_t)row_base[chunks.size()];
+    db->n_ids = id_base[chunks.size()];
+    db->kw.resize((size_t)WIDX_KW_LEN * db->n_rows);
+    db->offsets.resize((size_t)db->n_rows + 1);
+    db->ids.resize((size_t)WIDX_ID_LEN * db->n_ids);
+
+    WIdxDB *db_ptr = db;
+    const uint64_t *row_base_ptr = row_base.data();
+    const uint64_t *id_base_ptr = id_base.data();
+    TaskEngine_Run(chunks.size(), 1, [=](size_t begin, size_t end){
+        for(size_t c=begin;c<end;++c){
+            const WIdxChunk &chunk = chunk_ptr[c];
+            uint64_t row = row_base_ptr[c];
+            uint64_t off = id_base_ptr[c];
+            if(!chunk.kw.empty()) ::memcpy(db_ptr->kw.data()+(WIDX_KW_LEN*row),chunk.kw.data(),chunk.kw.size());
+            if(!chunk.ids.empty()) ::memcpy(db_ptr->ids.data()+(WIDX_ID_LEN*off),chunk.ids.data(),chunk.ids.size());
+            for(size_t r=0;r<chunk.row_ids.size();++r){
+                db_ptr->offsets[row+r] = off;
+                off += chunk.row_ids[r];
+            }
+        }
+    });
+    db->offsets[db->n_rows] = db->n_ids;
+
+    for(uint32_t r=0;r<db->n_rows;++r){
+        uint32_t n = WIdx_RowIds(db,r);
+        if(n > db->max_row_ids) db->max_row_ids = n;
+    }
+
+    ::munmap(map,file_len);
+
+    return 0;
+}
+
+int WIdx_Release(WIdxDB *db)
+{
+    db->n_rows = 0;
+    db->n_ids = 0;
+    db->max_row_ids = 0;
+    std::vector<unsigned char>().swap(db->kw);
+    std::vector<uint64_t>().swap(db->offsets);
+    std::vector<unsigned char>().swap(db->ids);
+    return 0;
+}
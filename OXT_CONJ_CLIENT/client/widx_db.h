@@ -0,0 +1,47 @@
+#ifndef WIDX_DB_H
+#define WIDX_DB_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//Plain inverted index (widxdb_file) in CSR form. Each text row is
+//  keyword,id,id,...,id,
+//with 8 hex digit (4 byte) keywords and ids; only comma terminated fields count.
+//Row r has keyword kw[4r..4r+3] and ids ids[4j..4j+3] for offsets[r] <= j < offsets[r+1],
+//bytes in the order of the hex text, as DB_StrToHex8 reads them.
+#define WIDX_KW_LEN 4
+#define WIDX_ID_LEN 4
+//Parse chunks handed to the task engine, each starts on a row boundary
+#define WIDX_MIN_CHUNK_BYTES (1 << 16)
+
+struct WIdxDB {
+    uint32_t n_rows;
+    uint64_t n_ids;
+    uint32_t max_row_ids;
+    std::vector<unsigned char> kw;
+    std::vector<uint64_t> offsets;
+    std::vector<unsigned char> ids;
+};
+
+//Maps the file and parses it in parallel chunks on the task engine
+int WIdx_Load(WIdxDB *db, const std::string &widx_file);
+int WIdx_Release(WIdxDB *db);
+
+static inline uint32_t WIdx_RowIds(const WIdxDB *db, uint32_t row)
+{
+    return (uint32_t)(db->offsets[row+1] - db->offsets[row]);
+}
+
+static inline const unsigned char *WIdx_RowKeyword(const WIdxDB *db, uint32_t row)
+{
+    return db->kw.data() + ((size_t)WIDX_KW_LEN * row);
+}
+
+static inline const unsigned char *WIdx_RowIdData(const WIdxDB *db, uint32_t row)
+{
+    return db->ids.data() + ((size_t)WIDX_ID_LEN * db->offsets[row]);
+}
+
+#endif // WIDX_DB_H
@@ -2,35 +2,187 @@
 #include <string.h>
 #include "aes.h"
 
+#include <immintrin.h>
+
+int AES_LoadKey(AESKeySchedule *ks,const uint8_t *key){
+    aes128_load_key((uint8_t*)key,ks->rk);
+    return 0;
+}
+
+int AES_LoadKeyEncOnly(AESKeySchedule *ks,const uint8_t *key){
+    aes128_load_key_enc_only((uint8_t*)key,ks->rk);
+    return 0;
+}
+
+//Bulk ECB kernels. One aesenc has a latency of several cycles but the unit accepts a new
+//one every cycle, so independent blocks are pushed through each round together.
+#define AES_X8(op) op(0) op(1) op(2) op(3) op(4) op(5) op(6) op(7)
+
+typedef void (*AESEncKernel)(const __m128i *k,uint8_t *ctext,const uint8_t *ptext,size_t n);
+
+static void aes_enc_blocks_aesni(const __m128i *k,uint8_t *ctext,const uint8_t *ptext,size_t n){
+    size_t i = 0;
+
+    for(;i+8<=n;i+=8){
+        const __m128i *in = (const __m128i *)(ptext+(16*i));
+        __m128i *out = (__m128i *)(ctext+(16*i));
+#define AES_LOAD(j) __m128i b##j = _mm_xor_si128(_mm_loadu_si128(in+j),k[0]);
+#define AES_ROUND(j) b##j = _mm_aesenc_si128(b##j,rk);
+#define AES_LAST(j) _mm_storeu_si128(out+j,_mm_aesenclast_si128(b##j,k[10]));
+        AES_X8(AES_LOAD)
+        for(int r=1;r<10;++r){
+            const __m128i rk = k[r];
+            AES_X8(AES_ROUND)
+        }
+        AES_X8(AES_LAST)
+#undef AES_LOAD
+#undef AES_ROUND
+#undef AES_LAST
+    }
+
+    for(;i<n;++i){
+        __m128i m = _mm_loadu_si128((const __m128i *)(ptext+(16*i)));
+        DO_ENC_BLOCK(m,k);
+        _mm_storeu_si128((__m128i *)(ctext+(16*i)), m);
+    }
+}
+
+//VAES: 2 blocks per ymm, 8 ymm in flight
+__attribute__((target("vaes,avx2")))
+static void aes_enc_blocks_vaes256(const __m128i *k,uint8_t *ctext,const uint8_t *ptext,size_t n){
+    size_t i = 0;
+    __m256i k2[11];
+
+    for(int r=0;r<11;++r) k2[r] = _mm256_broadcastsi128_si256(k[r]);
+
+    for(;i+16<=n;i+=16){
+        const __m256i *in = (const __m256i *)(ptext+(16*i));
+        __m256i *out = (__m256i *)(ctext+(16*i));
+#define AES_LOAD(j) __m256i b##j = _mm256_xor_si256(_mm256_loadu_si256(in+j),k2[0]);
+#define AES_ROUND(j) b##j = _mm256_aesenc_epi128(b##j,rk);
+#define AES_LAST(j) _mm256_storeu_si256(out+j,_mm256_aesenclast_epi128(b##j,k2[10]));
+        AES_X8(AES_LOAD)
+        for(int r=1;r<10;++r){
+            const __m256i rk = k2[r];
+            AES_X8(AES_ROUND)
+        }
+        AES_X8(AES_LAST)
+#undef AES_LOAD
+#undef AES_ROUND
+#undef AES_LAST
+    }
+
+    aes_enc_blocks_aesni(k,ctext+(16*i),ptext+(16*i),n-i);
+}
+
+//VAES: 4 blocks per zmm, 8 zmm in flight
+__attribute__((target("vaes,avx512f")))
+static void aes_enc_blocks_vaes512(const __m128i *k,uint8_t *ctext,const uint8_t *ptext,size_t n){
+    size_t i = 0;
+    __m512i k4[11];
+
+    for(int r=0;r<11;++r) k4[r] = _mm512_broadcast_i32x4(k[r]);
+
+    for(;i+32<=n;i+=32){
+        const __m512i *in = (const __m512i *)(ptext+(16*i));
+        __m512i *out = (__m512i *)(ctext+(16*i));
+#define AES_LOAD(j) __m512i b##j = _mm512_xor_si512(_mm512_loadu_si512(in+j),k4[0]);
+#define AES_ROUND(j) b##j = _mm512_aesenc_epi128(b##j,rk);
+#define AES_LAST(j) _mm512_storeu_si512(out+j,_mm512_aesenclast_epi128(b##j,k4[10]));
+        AES_X8(AES_LOAD)
+        for(int r=1;r<10;++r){
+            const __m512i rk = k4[r];
+            AES_X8(AES_ROUND)
+        }
+        AES_X8(AES_LAST)
+#undef AES_LOAD
+#undef AES_ROUND
+#undef AES_LAST
+    }
+
+    aes_enc_blocks_aesni(k,ctext+(16*i),ptext+(16*i),n-i);
+}
+
+//Picked once from the running CPU, not the build host
+static AESEncKernel aes_select_kernel(const char **name){
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx512f")){
+        *name = "vaes512";
+        return aes_enc_blocks_vaes512;
+    }
+    if(__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2")){
+        *name = "vaes256";
+        return aes_enc_blocks_vaes256;
+    }
+    *name = "aesni x8";
+    return aes_enc_blocks_aesni;
+}
+
+static const char *aes_kernel_name = nullptr;
+static const AESEncKernel aes_enc_kernel = aes_select_kernel(&aes_kernel_name);
+
+const char *AES_KernelName(){
+    return aes_kernel_name;
+}
+
+//ECB over n independent blocks with an already expanded key
+int AESENC_N(const AESKeySchedule *ks,uint8_t *ctext,const uint8_t *ptext,size_t n){
+    if(n < 8){
+        const __m128i *k = ks->rk;
+        for(size_t i=0;i<n;++i){
+            __m128i m = _mm_loadu_si128((const __m128i *)(ptext+(16*i)));
+            DO_ENC_BLOCK(m,k);
+            _mm_storeu_si128((__m128i *)(ctext+(16*i)), m);
+        }
+        return 0;
+    }
+    aes_enc_kernel(ks->rk,ctext,ptext,n);
+    return 0;
+}
+
+int AESDEC_N(const AESKeySchedule *ks,uint8_t *ptext,const uint8_t *ctext,size_t n){
+    const __m128i *k = ks->rk;
+    for(size_t i=0;i<n;++i){
+        __m128i m = _mm_loadu_si128((const __m128i *)(ctext+(16*i)));
+        DO_DEC_BLOCK(m,k);
+        _mm_storeu_si128((__m128i *)(ptext+(16*i)), m);
+    }
+    return 0;
+}
+
 //Replace with AES-CTR
 int AESENC(uint8_t *ctext,uint8_t *ptext,uint8_t *key){
-    __m128i key_schedule[20];
-    aes128_load_key(key,key_schedule);
-    aes128_enc(key_schedule,ptext,ctext);
+    AESKeySchedule ks;
+    AES_LoadKeyEncOnly(&ks,key);
+    AESENC_N(&ks,ctext,ptext,1);
     return 0;
 }
 
 //Replace with AES-CTR
 int AESDEC(uint8_t *ptext,uint8_t *ctext,uint8_t *key){
-    __m128i key_schedule[20];
-    aes128_load_key(key,key_schedule);
-    aes128_dec(key_schedule,ctext,ptext);
+    AESKeySchedule ks;
+    AES_LoadKey(&ks,key);
+    AESDEC_N(&ks,ptext,ctext,1);
     return 0;
 }
 
 //Replace with AES-CMAC
 int PRF_K(uint8_t *prf_out,uint8_t *ptext){
-    __m128i key_schedule[20];
-    aes128_load_key(prf_key,key_schedule);
-    aes128_enc(key_schedule,ptext,prf_out);
+    //prf_key is fixed, expand it once
+    static const AESKeySchedule prf_ks = [] {
+        AESKeySchedule ks;
+        AES_LoadKeyEncOnly(&ks,prf_key);
+        return ks;
+    }();
+    AESENC_N(&prf_ks,prf_out,ptext,1);
     return 0;
 }
 
 //For experimental/debugging purpose only
 //In practice, replace with AES-CMAC
 int PRF(uint8_t *ctext,uint8_t *ptext,uint8_t *key){
-    __m128i key_schedule[20];
-    aes128_load_key(key,key_schedule);
-    aes128_enc(key_schedule,ptext,ctext);
+    AESKeySchedule ks;
+    AES_LoadKeyEncOnly(&ks,key);
+    AESENC_N(&ks,ctext,ptext,1);
     return 0;
-}
\ No newline at end of file
+}
@@ -20,4 +20,140 @@ int Blake3_K(blake3_hasher *hasher, uint8_t *digest,uint8_t *message)
     blake3_hasher_update(hasher, message, 40);
     blake3_hasher_finalize(hasher, digest, BLAKE3_OUT_LEN);
     return 0;
-}
\ No newline at end of file
+}
+
+//A message of at most one block is a whole BLAKE3 input: its root is a single compression
+//of the IV with CHUNK_START|CHUNK_END|ROOT, counter 0 and block_len = message length.
+//blake3_hash_many only takes whole 64 byte blocks, so short messages get their own kernels
+//with lane l of every state vector belonging to message l.
+#define BLAKE3_MANY_CHUNK_START 1
+#define BLAKE3_MANY_CHUNK_END 2
+#define BLAKE3_MANY_ROOT 8
+
+static const uint32_t blake3_many_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t blake3_many_schedule[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+typedef void (*Blake3ManyKernel)(uint8_t *digest, size_t digest_stride, const uint8_t *msg, size_t msg_stride, size_t msg_len, size_t n);
+
+//Kernel body for L lanes of type V. Lanes past n hash zeros and are not written back.
+#define BLAKE3_MANY_ROTR(x,c) (((x) >> (c)) | ((x) << (32-(c))))
+#define BLAKE3_MANY_G(a,b,c,d,mx,my) \
+    a = a + b + mx; d = BLAKE3_MANY_ROTR(d ^ a, 16); c = c + d; b = BLAKE3_MANY_ROTR(b ^ c, 12); \
+    a = a + b + my; d = BLAKE3_MANY_ROTR(d ^ a, 8); c = c + d; b = BLAKE3_MANY_ROTR(b ^ c, 7);
+#define BLAKE3_MANY_BODY(V,L) \
+    alignas(64) uint32_t mw[16][L]; \
+    alignas(64) uint32_t hw[8][L]; \
+    const size_t n_words = (msg_len+3)/4; \
+    for(size_t base=0;base<n;base+=L){ \
+        size_t lanes = (n-base < (size_t)L) ? (n-base) : (size_t)L; \
+        ::memset(mw,0x00,sizeof(mw)); \
+        for(size_t l=0;l<lanes;++l){ \
+            uint8_t block[BLAKE3_BLOCK_LEN] = {0}; \
+            ::memcpy(block,msg+(msg_stride*(base+l)),msg_len); \
+            for(size_t w=0;w<n_words;++w) \
+                ::memcpy(&mw[w][l],block+(4*w),4); \
+        } \
+        V m[16]; \
+        for(int w=0;w<16;++w) \
+            ::memcpy(&m[w],mw[w],sizeof(V)); \
+        V v[16]; \
+        for(int w=0;w<8;++w){ \
+            v[w] = V{} + blake3_many_iv[w]; \
+            v[w+8] = V{} + blake3_many_iv[w]; \
+        } \
+        v[12] = V{}; \
+        v[13] = V{}; \
+        v[14] = V{} + (uint32_t)msg_len; \
+        v[15] = V{} + (uint32_t)(BLAKE3_MANY_CHUNK_START | BLAKE3_MANY_CHUNK_END | BLAKE3_MANY_ROOT); \
+        for(int r=0;r<7;++r){ \
+            const uint8_t *s = blake3_many_schedule[r]; \
+            BLAKE3_MANY_G(v[0],v[4],v[8],v[12],m[s[0]],m[s[1]]) \
+            BLAKE3_MANY_G(v[1],v[5],v[9],v[13],m[s[2]],m[s[3]]) \
+            BLAKE3_MANY_G(v[2],v[6],v[10],v[14],m[s[4]],m[s[5]]) \
+            BLAKE3_MANY_G(v[3],v[7],v[11],v[15],m[s[6]],m[s[7]]) \
+            BLAKE3_MANY_G(v[0],v[5],v[10],v[15],m[s[8]],m[s[9]]) \
+            BLAKE3_MANY_G(v[1],v[6],v[11],v[12],m[s[10]],m[s[11]]) \
+            BLAKE3_MANY_G(v[2],v[7],v[8],v[13],m[s[12]],m[s[13]]) \
+            BLAKE3_MANY_G(v[3],v[4],v[9],v[14],m[s[14]],m[s[15]]) \
+        } \
+        for(int w=0;w<8;++w){ \
+            V h = v[w] ^ v[w+8]; \
+            ::memcpy(hw[w],&h,sizeof(V)); \
+        } \
+        for(size_t l=0;l<lanes;++l){ \
+            uint8_t *out = digest+(digest_stride*(base+l)); \
+            for(int w=0;w<8;++w) \
+                ::memcpy(out+(4*w),&hw[w][l],4); \
+        } \
+    }
+
+typedef uint32_t Blake3V4 __attribute__((vector_size(16)));
+typedef uint32_t Blake3V8 __attribute__((vector_size(32)));
+typedef uint32_t Blake3V16 __attribute__((vector_size(64)));
+
+static void blake3_many_sse2(uint8_t *digest, size_t digest_stride, const uint8_t *msg, size_t msg_stride, size_t msg_len, size_t n){
+    BLAKE3_MANY_BODY(Blake3V4,4)
+}
+
+__attribute__((target("avx2")))
+static void blake3_many_avx2(uint8_t *digest, size_t digest_stride, const uint8_t *msg, size_t msg_stride, size_t msg_len, size_t n){
+    BLAKE3_MANY_BODY(Blake3V8,8)
+}
+
+__attribute__((target("avx512f")))
+static void blake3_many_avx512(uint8_t *digest, size_t digest_stride, const uint8_t *msg, size_t msg_stride, size_t msg_len, size_t n){
+    BLAKE3_MANY_BODY(Blake3V16,16)
+}
+
+#undef BLAKE3_MANY_BODY
+#undef BLAKE3_MANY_G
+#undef BLAKE3_MANY_ROTR
+
+//Picked once from the running CPU, not the build host
+static Blake3ManyKernel blake3_many_select_kernel(const char **name){
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")){
+        *name = "avx512 x16";
+        return blake3_many_avx512;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        *name = "avx2 x8";
+        return blake3_many_avx2;
+    }
+    *name = "sse2 x4";
+    return blake3_many_sse2;
+}
+
+static const char *blake3_many_kernel_name = nullptr;
+static const Blake3ManyKernel blake3_many_kernel = blake3_many_select_kernel(&blake3_many_kernel_name);
+
+const char *Blake3_KernelName()
+{
+    return blake3_many_kernel_name;
+}
+
+int Blake3_Many(uint8_t *digest, size_t digest_stride, const uint8_t *msg, size_t msg_stride, size_t msg_len, size_t n)
+{
+    if(msg_len > BLAKE3_BLOCK_LEN){
+        blake3_hasher hasher;
+        for(size_t i=0;i<n;++i){
+            blake3_hasher_init(&hasher);
+            blake3_hasher_update(&hasher, msg+(msg_stride*i), msg_len);
+            blake3_hasher_finalize(&hasher, digest+(digest_stride*i), BLAKE3_OUT_LEN);
+        }
+        return 0;
+    }
+    blake3_many_kernel(digest,digest_stride,msg,msg_stride,msg_len,n);
+    return 0;
+}
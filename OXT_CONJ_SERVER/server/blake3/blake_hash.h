@@ -6,4 +6,10 @@
 int Blake3(blake3_hasher *hasher, uint8_t *digest,uint8_t *message);
 int Blake3_K(blake3_hasher *hasher, uint8_t *digest,uint8_t *message);
 
+//Hashes n messages of msg_len <= BLAKE3_BLOCK_LEN bytes, message i at msg+(msg_stride*i),
+//into BLAKE3_OUT_LEN byte digests at digest+(digest_stride*i). Same digests as Blake3/Blake3_K,
+//but the single compression of each message runs in one lane of a SIMD batch.
+int Blake3_Many(uint8_t *digest, size_t digest_stride, const uint8_t *msg, size_t msg_stride, size_t msg_len, size_t n);
+const char *Blake3_KernelName();
+
 #endif // SIZEPARAMETERS_H
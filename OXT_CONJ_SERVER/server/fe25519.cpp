@@ -0,0 +1,112 @@
+#include "fe25519.h"
+
+static inline uint64_t load64_be(const unsigned char *s)
+{
+    uint64_t w = 0;
+    for(int i=0;i<8;++i){
+        w = (w << 8) | s[i];
+    }
+    return w;
+}
+
+static inline void store64_be(unsigned char *s, uint64_t w)
+{
+    for(int i=7;i>=0;--i){
+        s[i] = w & 0xFF;
+        w >>= 8;
+    }
+}
+
+int fe_frombytes(fe25519 &h, const unsigned char *s)
+{
+    uint64_t w0 = load64_be(s+24);
+    uint64_t w1 = load64_be(s+16);
+    uint64_t w2 = load64_be(s+8);
+    uint64_t w3 = load64_be(s);
+
+    h.v[0] = w0 & FE_MASK51;
+    h.v[1] = ((w0 >> 51) | (w1 << 13)) & FE_MASK51;
+    h.v[2] = ((w1 >> 38) | (w2 << 26)) & FE_MASK51;
+    h.v[3] = ((w2 >> 25) | (w3 << 39)) & FE_MASK51;
+    h.v[4] = (w3 >> 12) & FE_MASK51;
+
+    //Bit 255 is not dropped, the input is taken as a full 256 bit integer
+    h.v[0] += 19 * (w3 >> 63);
+
+    return 0;
+}
+
+int fe_tobytes(unsigned char *s, const fe25519 &h)
+{
+    uint64_t t[5];
+    uint64_t q;
+
+    //Three carry passes bring every limb below 2^51
+    for(int i=0;i<5;++i) t[i] = h.v[i];
+    for(int pass=0;pass<3;++pass){
+        t[1] += t[0] >> 51; t[0] &= FE_MASK51;
+        t[2] += t[1] >> 51; t[1] &= FE_MASK51;
+        t[3] += t[2] >> 51; t[2] &= FE_MASK51;
+        t[4] += t[3] >> 51; t[3] &= FE_MASK51;
+        t[0] += 19 * (t[4] >> 51); t[4] &= FE_MASK51;
+    }
+
+    //q = 1 iff t >= p, then t - q*p = t + 19*q - q*2^255
+    q = (t[0] + 19) >> 51;
+    q = (t[1] + q) >> 51;
+    q = (t[2] + q) >> 51;
+    q = (t[3] + q) >> 51;
+    q = (t[4] + q) >> 51;
+
+    t[0] += 19 * q;
+    t[1] += t[0] >> 51; t[0] &= FE_MASK51;
+    t[2] += t[1] >> 51; t[1] &= FE_MASK51;
+    t[3] += t[2] >> 51; t[2] &= FE_MASK51;
+    t[4] += t[3] >> 51; t[3] &= FE_MASK51;
+    t[4] &= FE_MASK51;
+
+    store64_be(s+24, t[0] | (t[1] << 51));
+    store64_be(s+16, (t[1] >> 13) | (t[2] << 38));
+    store64_be(s+8, (t[2] >> 26) | (t[3] << 25));
+    store64_be(s, (t[3] >> 39) | (t[4] << 12));
+
+    return 0;
+}
+
+static inline void fe_sqn(fe25519 &h, const fe25519 &f, int n)
+{
+    fe_sq(h,f);
+    for(int i=1;i<n;++i) fe_sq(h,h);
+}
+
+//z^(p-2) with the usual 254 squarings / 11 multiplications chain, z = 0 gives 0
+int fe_invert(fe25519 &out, const fe25519 &z)
+{
+    fe25519 z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+    fe_sq(z2,z);
+    fe_sqn(t,z2,2);
+    fe_mul(z9,t,z);
+    fe_mul(z11,z9,z2);
+    fe_sq(t,z11);
+    fe_mul(z2_5_0,t,z9);
+
+    fe_sqn(t,z2_5_0,5);
+    fe_mul(z2_10_0,t,z2_5_0);
+    fe_sqn(t,z2_10_0,10);
+    fe_mul(z2_20_0,t,z2_10_0);
+    fe_sqn(t,z2_20_0,20);
+    fe_mul(t,t,z2_20_0);
+    fe_sqn(t,t,10);
+    fe_mul(z2_50_0,t,z2_10_0);
+    fe_sqn(t,z2_50_0,50);
+    fe_mul(z2_100_0,t,z2_50_0);
+    fe_sqn(t,z2_100_0,100);
+    fe_mul(t,t,z2_100_0);
+    fe_sqn(t,t,50);
+    fe_mul(t,t,z2_50_0);
+    fe_sqn(t,t,5);
+    fe_mul(out,t,z11);
+
+    return 0;
+}
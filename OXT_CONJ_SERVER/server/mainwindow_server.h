@@ -37,6 +37,9 @@
 #include "rawdatautil.h"
 #include "ecc_x25519.h"
 #include "bloom_filter.h"
+#include "task_engine.h"
+#include "tset_store.h"
+#include "tset_cache.h"
 #include "./blake3/blake3.h" 
 #include "./blake3/blake_hash.h"
 
@@ -47,6 +50,24 @@
 using namespace std;
 using namespace sw::redis;
 
+//TSet_Retrieve fetches the row in MGET windows, starting small and doubling
+#define TSET_MGET_WINDOW 64
+#define TSET_MGET_MAX_WINDOW 1024
+//Entries per TSetStore_LoadPut issued while loading the TSet
+#define TSET_LOAD_BATCH 4096
+
+//State of one search, the retrieve and match phases only touch this and read-only globals
+struct SearchQuery {
+    int NWords;
+    unsigned char stag[16];
+    int n_ids_tset;
+    bool tset_cached; //tset_row came out of the TSet cache
+    std::vector<unsigned char> tset_row; //(y,e) pairs, 48 bytes each
+    std::vector<unsigned char> xtoken; //xtoken[n][i] at ((n*NWords)+i)*32
+    std::vector<unsigned char> eset; //e of the matching rows in the first 16*nmatch bytes
+    int nmatch;
+};
+
 extern sw::redis::ConnectionOptions connection_options;
 extern sw::redis::ConnectionPoolOptions pool_options;
 
@@ -71,51 +92,11 @@ extern unsigned char KZ[16];
 extern unsigned char KX[16];
 extern unsigned char KT[16];
 
-extern unsigned char **BF;
+extern unsigned char *BF;
 extern unsigned char *UIDX;
 
 extern unsigned int N_threads;
 
-extern unsigned char *GL_AES_PT;
-extern unsigned char *GL_AES_KT;
-extern unsigned char *GL_AES_CT;
-
-extern unsigned char *GL_ECC_INVA;
-extern unsigned char *GL_ECC_INVP;
-
-extern unsigned char *GL_ECC_SCA;
-extern unsigned char *GL_ECC_BP;
-extern unsigned char *GL_ECC_SMP;
-
-extern unsigned char *GL_ECC_INA;
-extern unsigned char *GL_ECC_INB;
-extern unsigned char *GL_ECC_PRD;
-
-extern unsigned char *GL_HASH_MSG;
-extern unsigned char *GL_HASH_DGST;
-
-extern unsigned char *GL_BLM_MSG;
-extern unsigned char *GL_BLM_DGST;
-
-extern unsigned char *GL_MGDB_RES;
-extern unsigned char *GL_MGDB_BIDX;
-extern unsigned char *GL_MGDB_JIDX;
-extern unsigned char *GL_MGDB_LBL;
-
-extern unsigned int *GL_OPCODE;
-
-extern std::mutex mrun;
-extern std::condition_variable dataReady;
-extern std::condition_variable workComplete;
-
-extern bool ready;
-extern bool processed;
-
-extern size_t nWorkerCount;//Number of threads
-extern int nCurrentIteration;
-
-extern std::vector<thread> thread_pool;
-
 int Sys_Init();
 int Sys_Clear();
 
@@ -125,53 +106,39 @@ int ReleaseThreads();
 int send_file(int sockfd, const char* filename);
 int receive_file(int sockfd, const char* filename);
 
-int WorkerThread(
-    unsigned char *AES_PT,
-    unsigned char *AES_KT,
-    unsigned char *AES_CT,
-    unsigned char *ECC_INVA,
-    unsigned char *ECC_INVP,
-    unsigned char *ECC_SCA,
-    unsigned char *ECC_BP,
-    unsigned char *ECC_SMP,
-    unsigned char *ECC_INA,
-    unsigned char *ECC_INB,
-    unsigned char *ECC_PRD,
-    unsigned char *HASH_MSG,
-    unsigned char *HASH_DGST,
-    unsigned char *BLM_MSG,
-    unsigned char *BLM_DGST,
-    unsigned char *MGDB_RES,
-    unsigned char *MGDB_BIDX,
-    unsigned char *MGDB_JIDX,
-    unsigned char *MGDB_LBL,
-    unsigned int *OPCODE
-);
-
 int TSet_SetUp(int socket_fd);
 int TSet_GetTag(unsigned char *word,unsigned char *stag);
+//-1 when the row could not be fetched up to its last entry, tset_row then holds the part found
 int TSet_Retrieve(unsigned char *stag,unsigned char *tset_row, int *n_ids_tset);
 
 int EDB_SetUp(int socket_fd);
-int EDB_Search(unsigned char *query_str, int NWords, int socket_fd);
+int EDB_SearchRetrieve(SearchQuery *query);
+int EDB_SearchMatch(SearchQuery *query);
+//EDB_SearchMatch in pieces: Begin once the xtoken length is known, then Entries for
+//consecutive ranges of TSet entries as their xtokens come in
+int EDB_SearchMatchBegin(SearchQuery *query);
+int EDB_SearchMatchEntries(SearchQuery *query, int begin, int end);
+uint64_t EDB_XTokenLen(const SearchQuery *query);
 
-int FPGA_AES_ENC(unsigned char *ptext,unsigned char *key, unsigned char *ctext);
-int FPGA_PRF(unsigned char *ptext,unsigned char *key, unsigned char *ctext);
+//Batched primitives: each call processes n items in one task engine submission
+int FPGA_AES_ENC(unsigned char *ptext,unsigned char *key, unsigned char *ctext, unsigned int n);
+int FPGA_PRF(unsigned char *ptext,unsigned char *key, unsigned char *ctext, unsigned int n);
 
-int FPGA_HASH(unsigned char *msg, unsigned char *digest);
-int FPGA_BLOOM_HASH(unsigned char *msg, unsigned char *digest);
+int FPGA_HASH(unsigned char *msg, unsigned char *digest, unsigned int n);
+int FPGA_BLOOM_HASH(unsigned char *msg, unsigned char *digest, unsigned int n);
 
-int FPGA_ECC_MUL(unsigned char *in_A, unsigned char *in_B, unsigned char *prod);
-int FPGA_ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx);
-int FPGA_ECC_SCAMUL(unsigned char *sca, unsigned char *prod);
-int FPGA_ECC_SCAMUL_BASE(unsigned char *sca, unsigned char *basep, unsigned char *prod);
+int FPGA_ECC_MUL(unsigned char *in_A, unsigned char *in_B, unsigned char *prod, unsigned int n);
+int FPGA_ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx, unsigned int n);
+int FPGA_ECC_SCAMUL(unsigned char *sca, unsigned char *prod, unsigned int n);
+int FPGA_ECC_SCAMUL_BASE(unsigned char *sca, unsigned char *basep, unsigned char *prod, unsigned int n);
 
-int MGDB_QUERY(unsigned char *RES, unsigned char *BIDX, unsigned char *JIDX, unsigned char *LBL);
 
 int SHA3_HASH(blake3_hasher *hasher,unsigned char *msg, unsigned char *digest);
 int SHA3_HASH_K(blake3_hasher *hasher,unsigned char *msg, unsigned char *digest);
 int ECC_FPINV(unsigned char *fp_x, unsigned char *fp_invx);
+int ECC_FPINV_N(unsigned char *fp_x, unsigned char *fp_invx, unsigned int n);
 int ECC_MUL(unsigned char *in_A,unsigned char *in_B,unsigned char *prod);
+int ECC_MUL_N(unsigned char *in_A,unsigned char *in_B,unsigned char *prod, unsigned int n);
 
 std::string HexToStr(unsigned char *hexarr,int len=16);
 std::string NumToHexStr(int num);
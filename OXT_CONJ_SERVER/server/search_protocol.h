@@ -0,0 +1,51 @@
+#ifndef SEARCH_PROTOCOL_H
+#define SEARCH_PROTOCOL_H
+
+#include <cstdint>
+#include <cstring>
+
+//Search messages are a 16 byte header followed by length bytes of payload. One
+//connection carries any number of queries, each one is the exchange
+//  client SEARCH_REQUEST -> server SEARCH_NIDS -> client SEARCH_XTOKEN -> server SEARCH_RESULT
+//with the request id of the SEARCH_REQUEST echoed in all four headers. The server
+//matches TSet entries as soon as their xtokens are in, so the client sends the
+//SEARCH_XTOKEN header first and the payload in windows as it computes them.
+//Fields are in host byte order, both ends run on x86.
+#define SEARCH_PROTO_VERSION 1
+
+#define MSG_SEARCH_REQUEST 1 //NWords(4) || stag(16)
+#define MSG_SEARCH_NIDS 2 //n_ids_tset(4)
+#define MSG_SEARCH_XTOKEN 3 //xtoken[n][i] at ((n*NWords)+i)*32, n_ids_tset*NWords*32 bytes
+#define MSG_SEARCH_RESULT 4 //nmatch(4) || e of the nmatch matching rows, 16 bytes each
+#define MSG_ERROR 5 //error code(4), the server closes the connection after it
+
+#define SEARCH_ERR_VERSION 1
+#define SEARCH_ERR_TYPE 2
+#define SEARCH_ERR_REQUEST_ID 3
+#define SEARCH_ERR_LENGTH 4
+#define SEARCH_ERR_NWORDS 5
+
+#define SEARCH_REQUEST_LEN 20
+//row_vec of the search mains holds 2048 bytes, i.e. 128 keywords
+#define SEARCH_MAX_NWORDS 127
+
+struct MsgHeader {
+    uint8_t type;
+    uint8_t version;
+    uint16_t reserved;
+    uint32_t request_id;
+    uint64_t length;
+};
+
+static_assert(sizeof(MsgHeader) == 16, "MsgHeader must be packed into 16 bytes");
+
+static inline void MsgHeader_Set(MsgHeader *hdr, uint8_t type, uint32_t request_id, uint64_t length)
+{
+    ::memset(hdr,0x00,sizeof(MsgHeader));
+    hdr->type = type;
+    hdr->version = SEARCH_PROTO_VERSION;
+    hdr->request_id = request_id;
+    hdr->length = length;
+}
+
+#endif // SEARCH_PROTOCOL_H
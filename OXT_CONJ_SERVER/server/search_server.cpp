@@ -0,0 +1,527 @@
+#include "search_server.h"
+#include "mainwindow_server.h"
+#include "search_protocol.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+//A connection alternates between reading a message (header, then payload), running
+//a phase on an executor and writing the reply. See search_protocol.h for the messages.
+//The xtoken payload is the exception: while it comes in (CONN_RECV_XTOKEN) the entries
+//whose xtokens are complete are already matched on an executor, one range at a time.
+enum SearchConnState {
+    CONN_RECV_HEADER,
+    CONN_RECV_PAYLOAD,
+    CONN_RECV_XTOKEN,
+    CONN_RETRIEVE,
+    CONN_MATCH,
+    CONN_SEND
+};
+
+struct SearchConn {
+    int fd;
+    SearchConnState state;
+    bool closed; //peer went away while a phase was running on an executor
+    unsigned int conn_idx;
+    unsigned int q_idx; //queries completed on this connection
+
+    uint8_t expect_type; //MSG_SEARCH_REQUEST between queries, MSG_SEARCH_XTOKEN after SEARCH_NIDS
+    uint32_t request_id;
+    bool close_after_send; //set once an error reply is queued
+
+    SearchQuery query;
+    int match_done; //entries matched so far
+    int match_end; //end of the range on an executor while match_running
+    bool match_running;
+
+    MsgHeader hdr;
+    unsigned char request[SEARCH_REQUEST_LEN];
+
+    unsigned char *in_buf;
+    size_t in_need;
+    size_t in_got;
+
+    std::vector<unsigned char> out_buf;
+    size_t out_sent;
+};
+
+static int se_epoll_fd = -1;
+static int se_event_fd = -1;
+
+//Connections waiting for an executor, and connections whose phase has finished
+static std::deque<SearchConn*> se_jobs;
+static std::mutex se_jobs_mutex;
+static std::condition_variable se_jobs_cv;
+static std::deque<SearchConn*> se_done;
+static std::mutex se_done_mutex;
+static bool se_stop = false;
+
+static std::vector<std::thread> se_executors;
+
+static void SearchServer_Executor()
+{
+    SearchConn *conn;
+    uint64_t one = 1;
+
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(se_jobs_mutex);
+            se_jobs_cv.wait(lock, [] { return se_stop || !se_jobs.empty(); });
+            if(se_stop) break;
+            conn = se_jobs.front();
+            se_jobs.pop_front();
+        }
+
+        //The event loop may move the state on while a range is matched, match_running stays put
+        if(conn->match_running){
+            EDB_SearchMatchEntries(&conn->query,conn->match_done,conn->match_end);
+        }
+        else{
+            EDB_SearchRetrieve(&conn->query);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(se_done_mutex);
+            se_done.push_back(conn);
+        }
+        if(write(se_event_fd,&one,sizeof(one)) < 0){
+            perror("eventfd write");
+        }
+    }
+}
+
+static void SearchConn_Watch(SearchConn *conn, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = conn;
+    epoll_ctl(se_epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void SearchConn_Close(SearchConn *conn)
+{
+    epoll_ctl(se_epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    close(conn->fd);
+    delete conn;
+}
+
+static void SearchConn_Expect(SearchConn *conn, SearchConnState state, unsigned char *buf, size_t len)
+{
+    conn->state = state;
+    conn->in_buf = buf;
+    conn->in_need = len;
+    conn->in_got = 0;
+    SearchConn_Watch(conn, EPOLLIN);
+}
+
+static void SearchConn_ExpectHeader(SearchConn *conn, uint8_t type)
+{
+    conn->expect_type = type;
+    SearchConn_Expect(conn, CONN_RECV_HEADER, (unsigned char*)&conn->hdr, sizeof(MsgHeader));
+}
+
+static void SearchConn_Send(SearchConn *conn, uint8_t type, const unsigned char *payload, uint64_t length)
+{
+    MsgHeader hdr;
+    MsgHeader_Set(&hdr, type, conn->request_id, length);
+
+    conn->out_buf.resize(sizeof(MsgHeader)+length);
+    ::memcpy(conn->out_buf.data(),&hdr,sizeof(MsgHeader));
+    if(length > 0){
+        ::memcpy(conn->out_buf.data()+sizeof(MsgHeader),payload,length);
+    }
+
+    conn->state = CONN_SEND;
+    conn->out_sent = 0;
+    SearchConn_Watch(conn, EPOLLOUT);
+}
+
+//Malformed input is answered with MSG_ERROR and the connection is closed, the
+//rest of the stream cannot be trusted to be aligned on a header
+static void SearchConn_Reject(SearchConn *conn, uint32_t err)
+{
+    cout << "[" << conn->conn_idx << ":" << conn->q_idx << "] Rejecting message type " << (int)conn->hdr.type << " length " << conn->hdr.length << " (error " << err << ")" << endl;
+    conn->close_after_send = true;
+    SearchConn_Send(conn, MSG_ERROR, (unsigned char*)&err, sizeof(err));
+}
+
+static void SearchConn_Queue(SearchConn *conn)
+{
+    {
+        std::lock_guard<std::mutex> lock(se_jobs_mutex);
+        se_jobs.push_back(conn);
+    }
+    se_jobs_cv.notify_one();
+}
+
+//Hands a phase to the executors, the socket is not watched until the phase is done
+static void SearchConn_Submit(SearchConn *conn, SearchConnState state)
+{
+    conn->state = state;
+    SearchConn_Watch(conn, 0);
+    SearchConn_Queue(conn);
+}
+
+//A peer that goes away while an executor holds the connection is freed once the job returns
+static void SearchConn_Drop(SearchConn *conn)
+{
+    if(conn->state == CONN_RETRIEVE || conn->state == CONN_MATCH || conn->match_running){
+        epoll_ctl(se_epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        conn->closed = true;
+    }
+    else{
+        SearchConn_Close(conn);
+    }
+}
+
+static void SearchConn_SendResult(SearchConn *conn)
+{
+    SearchQuery *query = &conn->query;
+
+    cout << "[" << conn->conn_idx << ":" << conn->q_idx << "] N IDs TSet: " << query->n_ids_tset << " Nmatch: " << query->nmatch
+         << (query->tset_cached ? " (cached TSet row)" : "") << endl;
+
+    //Only the e values of the matching rows are sent back
+    std::vector<unsigned char> result(sizeof(query->nmatch) + (16*(size_t)query->nmatch));
+    ::memcpy(result.data(),&query->nmatch,sizeof(query->nmatch));
+    ::memcpy(result.data()+sizeof(query->nmatch),query->eset.data(),16*(size_t)query->nmatch);
+    SearchConn_Send(conn, MSG_SEARCH_RESULT, result.data(), result.size());
+}
+
+//Starts matching the entries whose xtokens are all in, unless a range is already running.
+//Once the whole payload is in and matched the result goes out.
+static void SearchConn_MatchProgress(SearchConn *conn)
+{
+    if(conn->match_running){
+        return;
+    }
+
+    size_t entry_len = 32*(size_t)conn->query.NWords;
+    int n_ready = (conn->state == CONN_MATCH) ? conn->query.n_ids_tset : (int)(conn->in_got / entry_len);
+
+    if(n_ready > conn->match_done){
+        conn->match_end = n_ready;
+        conn->match_running = true;
+        SearchConn_Queue(conn);
+    }
+    else if(conn->state == CONN_MATCH){
+        SearchConn_SendResult(conn);
+    }
+}
+
+static void SearchConn_HeaderReceived(SearchConn *conn)
+{
+    MsgHeader *hdr = &conn->hdr;
+
+    if(hdr->version != SEARCH_PROTO_VERSION){
+        SearchConn_Reject(conn, SEARCH_ERR_VERSION);
+        return;
+    }
+    if(hdr->type != conn->expect_type){
+        SearchConn_Reject(conn, SEARCH_ERR_TYPE);
+        return;
+    }
+
+    if(hdr->type == MSG_SEARCH_REQUEST){
+        if(hdr->length != SEARCH_REQUEST_LEN){
+            SearchConn_Reject(conn, SEARCH_ERR_LENGTH);
+            return;
+        }
+        conn->request_id = hdr->request_id;
+        SearchConn_Expect(conn, CONN_RECV_PAYLOAD, conn->request, SEARCH_REQUEST_LEN);
+        return;
+    }
+
+    //MSG_SEARCH_XTOKEN, must belong to the query in flight and hold exactly its xtokens
+    if(hdr->request_id != conn->request_id){
+        SearchConn_Reject(conn, SEARCH_ERR_REQUEST_ID);
+        return;
+    }
+    if(hdr->length != EDB_XTokenLen(&conn->query)){
+        SearchConn_Reject(conn, SEARCH_ERR_LENGTH);
+        return;
+    }
+
+    conn->query.xtoken.resize(hdr->length);
+    EDB_SearchMatchBegin(&conn->query);
+    conn->match_done = 0;
+    conn->match_end = 0;
+    conn->match_running = false;
+
+    if(hdr->length == 0){
+        conn->state = CONN_MATCH;
+        SearchConn_Watch(conn, 0);
+        SearchConn_MatchProgress(conn);
+    }
+    else{
+        SearchConn_Expect(conn, CONN_RECV_XTOKEN, conn->query.xtoken.data(), hdr->length);
+    }
+}
+
+static void SearchConn_PayloadReceived(SearchConn *conn)
+{
+    uint32_t nwords = 0;
+    ::memcpy(&nwords,conn->request,4);
+    if(nwords > SEARCH_MAX_NWORDS){
+        SearchConn_Reject(conn, SEARCH_ERR_NWORDS);
+        return;
+    }
+
+    conn->query.NWords = nwords;
+    ::memcpy(conn->query.stag,conn->request+4,16);
+    conn->query.n_ids_tset = 0;
+    conn->query.tset_cached = false;
+    conn->query.nmatch = 0;
+    conn->query.xtoken.clear();
+    SearchConn_Submit(conn, CONN_RETRIEVE);
+}
+
+static void SearchConn_Sent(SearchConn *conn)
+{
+    if(conn->close_after_send){
+        SearchConn_Close(conn);
+    }
+    else if(conn->expect_type == MSG_SEARCH_REQUEST){
+        //SEARCH_NIDS went out, the xtokens of this query come next
+        SearchConn_ExpectHeader(conn, MSG_SEARCH_XTOKEN);
+    }
+    else{
+        //SEARCH_RESULT went out, the connection is ready for the next query
+        ++conn->q_idx;
+        SearchConn_ExpectHeader(conn, MSG_SEARCH_REQUEST);
+    }
+}
+
+static void SearchConn_PhaseDone(SearchConn *conn)
+{
+    if(conn->closed){
+        close(conn->fd);
+        delete conn;
+        return;
+    }
+
+    SearchQuery *query = &conn->query;
+
+    if(conn->state == CONN_RETRIEVE){
+        SearchConn_Send(conn, MSG_SEARCH_NIDS, (unsigned char*)&query->n_ids_tset, sizeof(query->n_ids_tset));
+    }
+    else{
+        conn->match_done = conn->match_end;
+        conn->match_running = false;
+        SearchConn_MatchProgress(conn);
+    }
+}
+
+static void SearchConn_Event(SearchConn *conn, uint32_t events)
+{
+    ssize_t r = 0;
+
+    if(conn->state == CONN_RETRIEVE || conn->state == CONN_MATCH){
+        //Only errors are reported while a phase runs, free the connection once the phase returns
+        SearchConn_Drop(conn);
+        return;
+    }
+
+    if(events & EPOLLERR){
+        SearchConn_Drop(conn);
+        return;
+    }
+
+    if(conn->state == CONN_SEND){
+        while(conn->out_sent < conn->out_buf.size()){
+            r = send(conn->fd, conn->out_buf.data()+conn->out_sent, conn->out_buf.size()-conn->out_sent, MSG_NOSIGNAL);
+            if(r > 0){
+                conn->out_sent += r;
+            }
+            else if(r < 0 && errno == EINTR){
+                continue;
+            }
+            else if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                return;
+            }
+            else{
+                SearchConn_Close(conn);
+                return;
+            }
+        }
+        SearchConn_Sent(conn);
+        return;
+    }
+
+    while(conn->in_got < conn->in_need){
+        r = recv(conn->fd, conn->in_buf+conn->in_got, conn->in_need-conn->in_got, 0);
+        if(r > 0){
+            conn->in_got += r;
+        }
+        else if(r < 0 && errno == EINTR){
+            continue;
+        }
+        else if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            if(conn->state == CONN_RECV_XTOKEN){
+                SearchConn_MatchProgress(conn);
+            }
+            return;
+        }
+        else{
+            //Closed by the client, or a socket error
+            SearchConn_Drop(conn);
+            return;
+        }
+    }
+
+    if(conn->state == CONN_RECV_XTOKEN){
+        //All xtokens are in, the socket is quiet until the result is sent
+        conn->state = CONN_MATCH;
+        SearchConn_Watch(conn, 0);
+        SearchConn_MatchProgress(conn);
+        return;
+    }
+
+    if(conn->state == CONN_RECV_HEADER){
+        SearchConn_HeaderReceived(conn);
+    }
+    else{
+        SearchConn_PayloadReceived(conn);
+    }
+}
+
+static void SearchServer_Accept(int listen_fd, unsigned int *n_conns)
+{
+    int fd;
+    int one = 1;
+    struct epoll_event ev;
+
+    while(true){
+        fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0){
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                perror("Connection error");
+            }
+            return;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        SearchConn *conn = new SearchConn;
+        conn->fd = fd;
+        conn->closed = false;
+        conn->q_idx = 0;
+        conn->conn_idx = (*n_conns)++;
+        conn->request_id = 0;
+        conn->close_after_send = false;
+        conn->query.NWords = 0;
+        conn->query.n_ids_tset = 0;
+        conn->query.tset_cached = false;
+        conn->query.nmatch = 0;
+        conn->match_done = 0;
+        conn->match_end = 0;
+        conn->match_running = false;
+        conn->out_sent = 0;
+
+        conn->expect_type = MSG_SEARCH_REQUEST;
+        conn->state = CONN_RECV_HEADER;
+        conn->in_buf = (unsigned char*)&conn->hdr;
+        conn->in_need = sizeof(MsgHeader);
+        conn->in_got = 0;
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if(epoll_ctl(se_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0){
+            perror("epoll_ctl");
+            close(fd);
+            delete conn;
+        }
+    }
+}
+
+static void SearchServer_Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(se_jobs_mutex);
+        se_stop = true;
+    }
+    se_jobs_cv.notify_all();
+
+    for(std::thread &executor : se_executors){
+        executor.join();
+    }
+    se_executors.clear();
+
+    if(se_event_fd >= 0) close(se_event_fd);
+    if(se_epoll_fd >= 0) close(se_epoll_fd);
+    se_event_fd = -1;
+    se_epoll_fd = -1;
+}
+
+int SearchServer_Run(int listen_fd)
+{
+    struct epoll_event ev;
+    struct epoll_event events[SEARCH_MAX_EVENTS];
+    std::deque<SearchConn*> done;
+    unsigned int n_conns = 0;
+    uint64_t n_done = 0;
+    int n_events = 0;
+
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    se_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    se_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(se_epoll_fd < 0 || se_event_fd < 0){
+        perror("epoll/eventfd");
+        SearchServer_Stop();
+        return -1;
+    }
+
+    //The listening socket is tagged with a null pointer, the eventfd with its own address
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(se_epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &se_event_fd;
+    epoll_ctl(se_epoll_fd, EPOLL_CTL_ADD, se_event_fd, &ev);
+
+    se_stop = false;
+    for(unsigned int i=0;i<SEARCH_N_EXECUTORS;++i){
+        se_executors.push_back(std::thread(SearchServer_Executor));
+    }
+
+    cout << "Serving search queries with " << SEARCH_N_EXECUTORS << " executors" << endl;
+
+    while(true){
+        n_events = epoll_wait(se_epoll_fd, events, SEARCH_MAX_EVENTS, -1);
+        if(n_events < 0){
+            if(errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for(int i=0;i<n_events;++i){
+            if(events[i].data.ptr == nullptr){
+                SearchServer_Accept(listen_fd, &n_conns);
+            }
+            else if(events[i].data.ptr == &se_event_fd){
+                if(read(se_event_fd,&n_done,sizeof(n_done)) < 0 && errno != EAGAIN){
+                    perror("eventfd read");
+                }
+                {
+                    std::lock_guard<std::mutex> lock(se_done_mutex);
+                    done.swap(se_done);
+                }
+                for(SearchConn *conn : done){
+                    SearchConn_PhaseDone(conn);
+                }
+                done.clear();
+            }
+            else{
+                SearchConn_Event((SearchConn*)events[i].data.ptr, events[i].events);
+            }
+        }
+    }
+
+    SearchServer_Stop();
+    return -1;
+}
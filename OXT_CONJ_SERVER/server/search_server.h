@@ -0,0 +1,16 @@
+#ifndef SEARCH_SERVER_H
+#define SEARCH_SERVER_H
+
+//Threads running the retrieve and match phases of queries; the lane work of a
+//phase is submitted to the task engine, so these mostly wait on redis and the pool
+#define SEARCH_N_EXECUTORS 8
+//Events handled per epoll_wait call
+#define SEARCH_MAX_EVENTS 64
+
+//epoll event loop serving concurrent search connections on listen_fd. Sockets are
+//non-blocking, every connection carries its own SearchQuery and protocol state and
+//runs any number of queries back to back (search_protocol.h).
+//Only returns on a fatal error of the loop itself.
+int SearchServer_Run(int listen_fd);
+
+#endif // SEARCH_SERVER_H
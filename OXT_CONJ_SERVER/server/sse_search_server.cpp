@@ -21,6 +21,7 @@
 
 
 #include "mainwindow_server.h"
+#include "search_server.h"
 #include "aes.h"
 
 using namespace std;
@@ -32,6 +33,7 @@ int N_row_ids = N_max_ids;
 
 string widxdb_file = "../databases/db6k.csv";//Raw enron database
 string bloomfilter_file = "bloom_filter.dat";//Bloom filter file
+string tset_store_file = "tset.bin";//TSet of the mmap store
 
 sw::redis::ConnectionOptions connection_options;
 sw::redis::ConnectionPoolOptions pool_options;
@@ -41,52 +43,12 @@ mpz_class InvExp{"72370055773322622139731865630429942408571163593799076060019509
 
 unsigned char ecc_basep[32] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x09};
 
-unsigned char **BF;
+unsigned char *BF;
 
 unsigned char *UIDX;
 
-unsigned char *GL_AES_PT;
-unsigned char *GL_AES_KT;
-unsigned char *GL_AES_CT;
-
-unsigned char *GL_ECC_INVA;
-unsigned char *GL_ECC_INVP;
-
-unsigned char *GL_ECC_SCA;
-unsigned char *GL_ECC_BP;
-unsigned char *GL_ECC_SMP;
-
-unsigned char *GL_ECC_INA;
-unsigned char *GL_ECC_INB;
-unsigned char *GL_ECC_PRD;
-
-unsigned char *GL_HASH_MSG;
-unsigned char *GL_HASH_DGST;
-
-unsigned char *GL_BLM_MSG;
-unsigned char *GL_BLM_DGST;
-
-unsigned char *GL_MGDB_RES;
-unsigned char *GL_MGDB_BIDX;
-unsigned char *GL_MGDB_JIDX;
-unsigned char *GL_MGDB_LBL;
-
-unsigned int *GL_OPCODE;
-
 unsigned int N_threads = 1;
 
-std::mutex mrun;
-std::condition_variable dataReady;
-std::condition_variable workComplete;
-
-bool ready = false;
-bool processed = false;
-
-size_t nWorkerCount = N_threads; //Number of threads
-int nCurrentIteration = 0;
-
-std::vector<thread> thread_pool;
-
 int sym_block_size = 0;
 int ecc_block_size = 0;
 int hash_block_size = 0;
@@ -176,7 +138,6 @@ int ReadConfAll(std::string db_conf_filename)
 
         ///////////////////////////////////////////////////////////////////////
 
-        nWorkerCount = N_threads;
         N_row_ids = N_max_ids;
 
         sym_block_size = N_threads * 16;
@@ -205,8 +166,48 @@ int ReadConfAll(std::string db_conf_filename)
     return 0;
 }
 
-int main()
+static void PrintUsage(const char *prog)
+{
+    cout << "Usage: " << prog << " [--tset redis|mmap|bucket] [--redis host:port,...] [--tset-cache MB]" << endl;
+}
+
+//--tset redis|mmap|bucket picks the TSet store, redis when not given.
+//--redis host:port,host:port,... shards a redis TSet over several servers.
+//--tset-cache MB bounds the cache of decoded TSet rows, 0 turns it off.
+//Any other option, or one of these without its value, prints the usage and exits.
+int main(int argc, char **argv)
 {
+    string tset_backend = "redis";
+    size_t tset_cache_mb = TSET_CACHE_DEFAULT_MB;
+    for(int i=1;i<argc;++i){
+        if(::strcmp(argv[i],"--tset") == 0 && i+1 < argc){
+            tset_backend = argv[++i];
+        }
+        else if(::strcmp(argv[i],"--redis") == 0 && i+1 < argc){
+            if(TSetStore_SetRedisShards(argv[++i]) < 0){
+                exit(1);
+            }
+        }
+        else if(::strcmp(argv[i],"--tset-cache") == 0 && i+1 < argc){
+            const char *mb = argv[++i];
+            char *end = nullptr;
+            errno = 0;
+            tset_cache_mb = ::strtoul(mb,&end,10);
+            if(!isdigit((unsigned char)mb[0]) || *end != '\0' || errno != 0 || tset_cache_mb > (SIZE_MAX >> 20)){
+                cout << "Bad TSet cache size " << mb << ", expected --tset-cache MB" << endl;
+                exit(1);
+            }
+        }
+        else{
+            cout << "Unknown option or missing value: " << argv[i] << endl;
+            PrintUsage(argv[0]);
+            exit(1);
+        }
+    }
+    if(TSetStore_Init(tset_backend) < 0){
+        exit(1);
+    }
+
     cout << "Starting program..." << endl;
 
     ReadConfAll("../configuration/db6k.conf");
@@ -215,11 +216,6 @@ int main()
     ::memset(UIDX,0x00,16*N_max_ids);
     
     ////////////////////////////////////////////////////////////////////////////////////////////////////////
-    
-    std::vector<std::string> query;
-
-    unsigned int n_keywords = 0;
-    unsigned int n_iterations = 100;//Number of text vectors to search
 
     //----------------------------------------------------------------------------------------------
 
@@ -232,9 +228,8 @@ int main()
 
 	// CONNECTION VARIABLES ----------------------------------------------------------------------------------------------
     int portno = 8080;
-    int sockfd, newsockfd;
-    socklen_t clilen;
-    struct sockaddr_in cli_addr, serv_addr;
+    int sockfd;
+    struct sockaddr_in serv_addr;
 
     //----------------------------------------------------------------------------------------------
 
@@ -248,28 +243,17 @@ int main()
     Sys_Init();
     
     std::cout << "Reading Bloom Filter from disk..." << std::endl;
-    BloomFilter_ReadBFfromFile(bloomfilter_file, BF); //Load bloom filter from file
+    if(BloomFilter_ReadBFfromFile(bloomfilter_file, BF) != 0){ //Map bloom filter from file
+        Sys_Clear();
+        exit(1);
+    }
+    if(TSetStore_Open() < 0){
+        Sys_Clear();
+        exit(1);
+    }
+    TSetCache_Init(tset_cache_mb << 20);
     //----------------------------------------------------------------------------------------------
     // Search
-    
-    auto search_start_time = std::chrono::high_resolution_clock::now();
-    auto search_stop_time = std::chrono::high_resolution_clock::now();
-    auto search_time_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(search_stop_time - search_start_time).count();
-
-    unsigned int kw_idx = 0;
-    unsigned int kw_freq = 0;
-    unsigned int n_q_kw = 2;//Number of keywords in a query to search for
-
-    std::vector<unsigned int> idx_vec;
-    std::map<unsigned int,unsigned int> freq_map;
-    std::vector<unsigned int> idx_sorted;
-    std::vector<unsigned int> freq_sorted;
-    std::vector<std::string> kw_sorted;
-
-    unsigned int nm = 0;
-    unsigned char row_vec[2048]; //16 bytes * Number of keywords in the query
-    int n_vec = 0;
-    std::set<std::string> result_temp;
 
 	/*
 	
@@ -283,6 +267,9 @@ int main()
 		perror("Socket can't be opened\n");
 		exit(1);
 	}
+	int reuse = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
 	serv_addr.sin_family = AF_INET;
 	serv_addr.sin_addr.s_addr = INADDR_ANY;
 	serv_addr.sin_port = htons(portno);
@@ -292,65 +279,14 @@ int main()
 		perror("Could not bind\n");
 		exit(1);
 	}
-	listen(sockfd, 1);
+	listen(sockfd, SOMAXCONN);
 
-    unsigned int q_idx = 0;
-    while(true){
-        std::cout << "--------------------------------------------------" << std::endl;
-        cout<<q_idx%100<<endl;
-        query.clear();
-        freq_map.clear();
-
-        ::memset(row_vec,0x00,2048);
-        n_vec = 0;
-        
-        ::memset(UIDX,0x00,16*N_max_ids);
-        result_temp.clear();
-
-		/*
-		
-		accept a client connection
-		
-		*/
-		clilen = sizeof(cli_addr);
-		cout<<"waiting for accept"<<endl;
-		newsockfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
-		cout<<"after accept"<<endl;
-		if (newsockfd == -1)
-		{
-			perror("Connection error\n");
-			exit(1);
-		}
-		else{
-		        cout<<"accepted connection with client"<<endl;
-		}
-
-        //-------------------------------------------------------------------------------
-        search_start_time = std::chrono::high_resolution_clock::now();
-
-        // assuming conjunctive queries contain 2 keywords, hardcode n_vec = 2
-        n_vec = 2;
-        
-        nm = EDB_Search(row_vec,(n_vec-1), newsockfd);
-
-        search_stop_time = std::chrono::high_resolution_clock::now();
-        search_time_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(search_stop_time - search_start_time).count();
-
-        // std::cout << "Search done!" << std::endl;
-
-        result_temp.clear();
-        query.clear();
-
-		/*
-		
-		close newsockfd
-		
-		*/
-		close(newsockfd); 
-        // cout<<q_idx<<": newsockfd is closed"<<endl;
-
-        q_idx++;
-    }
+    /*
+    
+    serve queries from any number of concurrent clients, the number of keywords of a query is carried in its request
+    
+    */
+    SearchServer_Run(sockfd);
 
 	/*
 	
@@ -363,6 +299,9 @@ int main()
 
     //----------------------------------------------------------------------------------------------
     // Thread Release
+    TSetCache_PrintStats();
+    TSetCache_Release();
+    TSetStore_Close();
     Sys_Clear();
     delete [] UIDX;
     //----------------------------------------------------------------------------------------------
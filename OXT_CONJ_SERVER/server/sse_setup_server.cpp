@@ -31,6 +31,7 @@ int N_row_ids = N_max_ids;
 
 string widxdb_file = "../databases/db6k.csv";//Raw enron database
 string bloomfilter_file = "bloom_filter.dat";//Bloom filter file
+string tset_store_file = "tset.bin";//TSet of the mmap store
 
 sw::redis::ConnectionOptions connection_options;
 sw::redis::ConnectionPoolOptions pool_options;
@@ -40,52 +41,12 @@ mpz_class InvExp{"72370055773322622139731865630429942408571163593799076060019509
 
 unsigned char ecc_basep[32] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x09};
 
-unsigned char **BF;
+unsigned char *BF;
 
 unsigned char *UIDX;
 
-unsigned char *GL_AES_PT;
-unsigned char *GL_AES_KT;
-unsigned char *GL_AES_CT;
-
-unsigned char *GL_ECC_INVA;
-unsigned char *GL_ECC_INVP;
-
-unsigned char *GL_ECC_SCA;
-unsigned char *GL_ECC_BP;
-unsigned char *GL_ECC_SMP;
-
-unsigned char *GL_ECC_INA;
-unsigned char *GL_ECC_INB;
-unsigned char *GL_ECC_PRD;
-
-unsigned char *GL_HASH_MSG;
-unsigned char *GL_HASH_DGST;
-
-unsigned char *GL_BLM_MSG;
-unsigned char *GL_BLM_DGST;
-
-unsigned char *GL_MGDB_RES;
-unsigned char *GL_MGDB_BIDX;
-unsigned char *GL_MGDB_JIDX;
-unsigned char *GL_MGDB_LBL;
-
-unsigned int *GL_OPCODE;
-
 unsigned int N_threads = 16;//Default number of threads to use
 
-std::mutex mrun;
-std::condition_variable dataReady;
-std::condition_variable workComplete;
-
-bool ready = false;
-bool processed = false;
-
-size_t nWorkerCount = N_threads; //Number of threads
-int nCurrentIteration = 0;
-
-std::vector<thread> thread_pool;
-
 int sym_block_size = 0;
 int ecc_block_size = 0;
 int hash_block_size = 0;
@@ -175,7 +136,6 @@ int ReadConfAll(std::string db_conf_filename)
 
         ///////////////////////////////////////////////////////////////////////
 
-        nWorkerCount = N_threads;
         N_row_ids = N_max_ids;
 
         sym_block_size = N_threads * 16;
@@ -203,8 +163,36 @@ int ReadConfAll(std::string db_conf_filename)
     return 0;
 }
 
-int main()
+static void PrintUsage(const char *prog)
 {
+    cout << "Usage: " << prog << " [--tset redis|mmap|bucket] [--redis host:port,...]" << endl;
+}
+
+//--tset redis|mmap|bucket picks the TSet store, redis when not given.
+//--redis host:port,host:port,... shards a redis TSet over several servers.
+//Any other option, or one of these without its value, prints the usage and exits.
+int main(int argc, char **argv)
+{
+    string tset_backend = "redis";
+    for(int i=1;i<argc;++i){
+        if(::strcmp(argv[i],"--tset") == 0 && i+1 < argc){
+            tset_backend = argv[++i];
+        }
+        else if(::strcmp(argv[i],"--redis") == 0 && i+1 < argc){
+            if(TSetStore_SetRedisShards(argv[++i]) < 0){
+                exit(1);
+            }
+        }
+        else{
+            cout << "Unknown option or missing value: " << argv[i] << endl;
+            PrintUsage(argv[0]);
+            exit(1);
+        }
+    }
+    if(TSetStore_Init(tset_backend) < 0){
+        exit(1);
+    }
+
 
     // CONNECTION VARIABLES ----------------------------------------------------------------------------------------------
     int portno = 8080;
@@ -259,7 +247,13 @@ int main()
 
     Sys_Init();
     
-    EDB_SetUp(newsockfd);
+    if(EDB_SetUp(newsockfd) < 0){
+        cout << "TSet setup failed" << endl;
+        Sys_Clear();
+        close(newsockfd);
+        close(sockfd);
+        exit(1);
+    }
 
     std::cout << "[SERVER] Going to receive bloomfilter file from client..." << std::endl;
     // BloomFilter_WriteBFtoFile(bloomfilter_file, BF); //Store bloom filter in file
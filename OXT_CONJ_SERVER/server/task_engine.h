@@ -0,0 +1,21 @@
+#ifndef TASK_ENGINE_H
+#define TASK_ENGINE_H
+
+#include <cstddef>
+#include <functional>
+
+//Body of a submission, called with a half-open item range [begin,end)
+typedef std::function<void(size_t begin, size_t end)> TaskBody;
+
+//Work-stealing pool: one deque per worker, owners pop from the front and idle
+//workers steal from the back of the other deques. Several threads may submit
+//concurrently; each submission blocks until all of its chunks are processed.
+//A submission from inside a task runs the whole range inline on that worker.
+int TaskEngine_Init(unsigned int n_workers);
+int TaskEngine_Release();
+
+int TaskEngine_Run(size_t n_items, size_t grain, const TaskBody &body);
+size_t TaskEngine_Grain(size_t n_items, size_t item_bytes);
+unsigned int TaskEngine_Workers();
+
+#endif // TASK_ENGINE_H
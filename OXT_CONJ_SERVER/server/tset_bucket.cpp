@@ -0,0 +1,241 @@
+#include "tset_store.h"
+
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Entries received during setup, S is only known once all of them are in
+static std::vector<unsigned char> tset_pending;
+
+static unsigned char *tset_map = nullptr;
+static size_t tset_map_len = 0;
+static unsigned char *tset_slots = nullptr;
+static uint32_t tset_bucket_slots = 0;
+
+static inline uint32_t TSetBucket_Bidx(const unsigned char *key)
+{
+    return (key[1] << 8) + key[0];
+}
+
+static inline uint32_t TSetBucket_Jidx(const unsigned char *key)
+{
+    return (key[3] << 8) + key[2];
+}
+
+static int TSetBucket_LoadBegin()
+{
+    tset_pending.clear();
+    return 0;
+}
+
+static int TSetBucket_LoadPut(const unsigned char *entries, size_t n)
+{
+    tset_pending.insert(tset_pending.end(),entries,entries+(TSET_ENTRY_LEN*n));
+    return 0;
+}
+
+//Written under a temporary name and renamed, a search server never maps a partial table
+static int TSetBucket_LoadEnd()
+{
+    uint64_t n_entries = tset_pending.size() / TSET_ENTRY_LEN;
+
+    //S covers the largest jidx, so the first probe of every entry is in its bucket,
+    //and the fullest bucket, so every entry finds a free slot
+    std::vector<uint32_t> fill(TSET_N_BUCKETS,0);
+    uint32_t n_bucket_slots = 1;
+    const unsigned char *entry = tset_pending.data();
+    for(uint64_t i=0;i<n_entries;++i){
+        uint32_t bidx = TSetBucket_Bidx(entry);
+        n_bucket_slots = std::max(n_bucket_slots,TSetBucket_Jidx(entry) + 1);
+        n_bucket_slots = std::max(n_bucket_slots,++fill[bidx]);
+        entry += TSET_ENTRY_LEN;
+    }
+
+    size_t file_len = TSET_FILE_HEADER_SIZE + ((size_t)TSET_BUCKET_SLOT_LEN*TSET_N_BUCKETS*n_bucket_slots);
+    std::string tmp_file = tset_store_file + ".tmp";
+
+    int fd = ::open(tmp_file.data(),O_RDWR | O_CREAT | O_TRUNC,0644);
+    if(fd < 0){
+        std::cout << "Could not open " << tmp_file << " for writing" << std::endl;
+        return -1;
+    }
+    if(::ftruncate(fd,file_len) < 0){
+        std::cout << "Could not size " << tmp_file << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    unsigned char *map = (unsigned char *)::mmap(nullptr,file_len,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    if(map == MAP_FAILED){
+        std::cout << "Could not map " << tmp_file << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    TSetBucketHeader header;
+    ::memset(&header,0x00,sizeof(TSetBucketHeader));
+    ::memcpy(header.magic,TSET_BUCKET_MAGIC,8);
+    header.version = TSET_BUCKET_VERSION;
+    header.slot_len = TSET_BUCKET_SLOT_LEN;
+    header.n_buckets = TSET_N_BUCKETS;
+    header.n_bucket_slots = n_bucket_slots;
+
+    //The file is zero filled, every slot starts out unused
+    unsigned char *slots = map + TSET_FILE_HEADER_SIZE;
+    entry = tset_pending.data();
+    for(uint64_t i=0;i<n_entries;++i){
+        unsigned char *bucket = slots + ((size_t)TSET_BUCKET_SLOT_LEN*n_bucket_slots*TSetBucket_Bidx(entry));
+        uint32_t pos = TSetBucket_Jidx(entry);
+        unsigned char *slot = bucket + (TSET_BUCKET_SLOT_LEN*pos);
+        while(slot[TSET_BUCKET_SLOT_LEN-1] && ::memcmp(slot,entry+2,TSET_KEY_LEN-2) != 0){
+            pos = (pos + 1 == n_bucket_slots) ? 0 : pos + 1;
+            slot = bucket + (TSET_BUCKET_SLOT_LEN*pos);
+        }
+        //A repeated key replaces the earlier value, as a redis SET would
+        if(!slot[TSET_BUCKET_SLOT_LEN-1]) ++header.n_entries;
+        ::memcpy(slot,entry+2,TSET_ENTRY_LEN-2);
+        slot[TSET_BUCKET_SLOT_LEN-1] = 1;
+        entry += TSET_ENTRY_LEN;
+    }
+
+    ::memcpy(map,&header,sizeof(TSetBucketHeader));
+
+    int ret = 0;
+    if(::msync(map,file_len,MS_SYNC) < 0) ret = -1;
+    ::munmap(map,file_len);
+    if(::close(fd) < 0) ret = -1;
+
+    if(ret == 0 && ::rename(tmp_file.data(),tset_store_file.data()) < 0) ret = -1;
+    if(ret < 0){
+        std::cout << "Could not write " << tset_store_file << std::endl;
+        return -1;
+    }
+
+    std::cout << "TSet store: " << header.n_entries << " entries in " << TSET_N_BUCKETS << " buckets of " << n_bucket_slots << " slots" << std::endl;
+
+    std::vector<unsigned char>().swap(tset_pending);
+
+    return 0;
+}
+
+static int TSetBucket_Open()
+{
+    int fd = ::open(tset_store_file.data(),O_RDONLY);
+    if(fd < 0){
+        std::cout << "Could not open " << tset_store_file << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if(::fstat(fd,&st) < 0 || (size_t)st.st_size < TSET_FILE_HEADER_SIZE){
+        std::cout << tset_store_file << " is not a TSet file" << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    unsigned char *map = (unsigned char *)::mmap(nullptr,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    ::close(fd);
+    if(map == MAP_FAILED){
+        std::cout << "Could not map " << tset_store_file << std::endl;
+        return -1;
+    }
+
+    TSetBucketHeader header;
+    ::memcpy(&header,map,sizeof(TSetBucketHeader));
+
+    bool valid = (::memcmp(header.magic,TSET_BUCKET_MAGIC,8) == 0) &&
+                 (header.version == TSET_BUCKET_VERSION) &&
+                 (header.slot_len == TSET_BUCKET_SLOT_LEN) &&
+                 (header.n_buckets == TSET_N_BUCKETS) &&
+                 (header.n_bucket_slots != 0) &&
+                 ((size_t)st.st_size == TSET_FILE_HEADER_SIZE + ((size_t)TSET_BUCKET_SLOT_LEN*TSET_N_BUCKETS*header.n_bucket_slots));
+    if(!valid){
+        std::cout << tset_store_file << " is not a bucketed TSet file of this version" << std::endl;
+        ::munmap(map,st.st_size);
+        return -1;
+    }
+
+    //Lookups land on random buckets
+    ::madvise(map,st.st_size,MADV_RANDOM);
+
+    tset_map = map;
+    tset_map_len = st.st_size;
+    tset_slots = map + TSET_FILE_HEADER_SIZE;
+    tset_bucket_slots = header.n_bucket_slots;
+
+    std::cout << "TSet store: mapped " << header.n_entries << " entries in buckets of " << tset_bucket_slots << " slots" << std::endl;
+
+    return 0;
+}
+
+static int TSetBucket_Get(unsigned char *RES, const unsigned char *KEYS, unsigned char *HIT, unsigned int n)
+{
+    //Slot addresses depend on the keys only, start all loads before comparing any
+    for(unsigned int i=0;i<n;++i){
+        const unsigned char *key = KEYS + (TSET_KEY_LEN*i);
+        uint32_t jidx = TSetBucket_Jidx(key);
+        if(jidx < tset_bucket_slots){
+            __builtin_prefetch(tset_slots + ((size_t)TSET_BUCKET_SLOT_LEN*(((size_t)tset_bucket_slots*TSetBucket_Bidx(key)) + jidx)));
+        }
+    }
+
+    for(unsigned int i=0;i<n;++i){
+        const unsigned char *key = KEYS + (TSET_KEY_LEN*i);
+        uint32_t pos = TSetBucket_Jidx(key);
+        const unsigned char *bucket = tset_slots + ((size_t)TSET_BUCKET_SLOT_LEN*tset_bucket_slots*TSetBucket_Bidx(key));
+        const unsigned char *slot = nullptr;
+
+        //A jidx past S was never stored, otherwise walk on until the label or a free slot
+        if(pos < tset_bucket_slots){
+            for(uint32_t probe=0;probe<tset_bucket_slots;++probe){
+                const unsigned char *s = bucket + (TSET_BUCKET_SLOT_LEN*pos);
+                if(!s[TSET_BUCKET_SLOT_LEN-1]) break;
+                if(::memcmp(s,key+2,TSET_KEY_LEN-2) == 0){
+                    slot = s;
+                    break;
+                }
+                pos = (pos + 1 == tset_bucket_slots) ? 0 : pos + 1;
+            }
+        }
+
+        if(slot != nullptr){
+            ::memcpy(RES+(TSET_VAL_LEN*i),slot+(TSET_KEY_LEN-2),TSET_VAL_LEN);
+            HIT[i] = 1;
+        }
+        else{
+            ::memset(RES+(TSET_VAL_LEN*i),0x00,TSET_VAL_LEN);
+            HIT[i] = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int TSetBucket_Close()
+{
+    if(tset_map != nullptr){
+        ::munmap(tset_map,tset_map_len);
+    }
+    tset_map = nullptr;
+    tset_map_len = 0;
+    tset_slots = nullptr;
+    tset_bucket_slots = 0;
+    return 0;
+}
+
+const TSetStoreOps tset_store_bucket = {
+    "bucket",
+    TSetBucket_LoadBegin,
+    TSetBucket_LoadPut,
+    TSetBucket_LoadEnd,
+    TSetBucket_Open,
+    TSetBucket_Get,
+    TSetBucket_Close
+};
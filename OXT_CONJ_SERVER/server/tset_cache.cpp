@@ -0,0 +1,150 @@
+#include "tset_cache.h"
+
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct TSetCacheRow {
+    std::string stag;
+    int n_ids_tset;
+    std::vector<unsigned char> tset_row;
+};
+
+//Most recently used row at the front, the map points into the list
+static std::list<TSetCacheRow> tc_rows;
+static std::unordered_map<std::string,std::list<TSetCacheRow>::iterator> tc_index;
+static std::mutex tc_mutex;
+static TSetCacheStats tc_stats;
+
+static inline size_t TSetCache_RowBytes(int n_ids_tset)
+{
+    return (48*(size_t)n_ids_tset) + TSET_CACHE_ROW_OVERHEAD;
+}
+
+int TSetCache_Init(size_t max_bytes)
+{
+    std::lock_guard<std::mutex> lock(tc_mutex);
+
+    tc_rows.clear();
+    tc_index.clear();
+    ::memset(&tc_stats,0x00,sizeof(TSetCacheStats));
+    tc_stats.max_bytes = max_bytes;
+
+    std::cout << "TSet cache: " << (max_bytes >> 20) << " MB" << std::endl;
+    return 0;
+}
+
+int TSetCache_Release()
+{
+    std::lock_guard<std::mutex> lock(tc_mutex);
+
+    tc_rows.clear();
+    tc_index.clear();
+    tc_stats.n_rows = 0;
+    tc_stats.bytes = 0;
+    return 0;
+}
+
+int TSetCache_Lookup(const unsigned char *stag, unsigned char *tset_row, int *n_ids_tset)
+{
+    int hit = 0;
+    uint64_t n_lookups = 0;
+
+    //max_bytes only changes in TSetCache_Init, before the search threads start
+    if(tc_stats.max_bytes == 0){
+        return 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(tc_mutex);
+
+        auto it = tc_index.find(std::string((const char *)stag,16));
+        if(it != tc_index.end()){
+            tc_rows.splice(tc_rows.begin(),tc_rows,it->second);
+            *n_ids_tset = it->second->n_ids_tset;
+            ::memcpy(tset_row,it->second->tset_row.data(),it->second->tset_row.size());
+            ++tc_stats.hits;
+            hit = 1;
+        }
+        else{
+            ++tc_stats.misses;
+        }
+
+        n_lookups = tc_stats.hits + tc_stats.misses;
+    }
+
+    if(n_lookups % TSET_CACHE_REPORT == 0){
+        TSetCache_PrintStats();
+    }
+
+    return hit;
+}
+
+int TSetCache_Insert(const unsigned char *stag, const unsigned char *tset_row, int n_ids_tset)
+{
+    size_t row_bytes = TSetCache_RowBytes(n_ids_tset);
+
+    if(tc_stats.max_bytes == 0){
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(tc_mutex);
+
+    //Rows larger than the whole cache are not kept
+    if(n_ids_tset < 0 || row_bytes > tc_stats.max_bytes){
+        return 0;
+    }
+
+    std::string key((const char *)stag,16);
+
+    //Two queries of the same stag may both miss, the row is the same
+    if(tc_index.find(key) != tc_index.end()){
+        return 0;
+    }
+
+    while(tc_stats.bytes + row_bytes > tc_stats.max_bytes && !tc_rows.empty()){
+        TSetCacheRow &oldest = tc_rows.back();
+        tc_stats.bytes -= TSetCache_RowBytes(oldest.n_ids_tset);
+        tc_index.erase(oldest.stag);
+        tc_rows.pop_back();
+        --tc_stats.n_rows;
+        ++tc_stats.evictions;
+    }
+
+    tc_rows.push_front(TSetCacheRow());
+    TSetCacheRow &row = tc_rows.front();
+    row.stag = key;
+    row.n_ids_tset = n_ids_tset;
+    row.tset_row.assign(tset_row,tset_row+(48*(size_t)n_ids_tset));
+    tc_index[key] = tc_rows.begin();
+
+    tc_stats.bytes += row_bytes;
+    ++tc_stats.n_rows;
+
+    return 0;
+}
+
+int TSetCache_GetStats(TSetCacheStats *stats)
+{
+    std::lock_guard<std::mutex> lock(tc_mutex);
+    *stats = tc_stats;
+    return 0;
+}
+
+int TSetCache_PrintStats()
+{
+    TSetCacheStats stats;
+    TSetCache_GetStats(&stats);
+
+    uint64_t n_lookups = stats.hits + stats.misses;
+    double hit_rate = (n_lookups == 0) ? 0.0 : (100.0*stats.hits)/n_lookups;
+
+    std::cout << "TSet cache: " << stats.hits << " hits, " << stats.misses << " misses (" << hit_rate << "%), "
+              << stats.n_rows << " rows in " << stats.bytes << " of " << stats.max_bytes << " bytes, "
+              << stats.evictions << " evictions" << std::endl;
+    return 0;
+}
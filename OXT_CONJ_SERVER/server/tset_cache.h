@@ -0,0 +1,36 @@
+#ifndef TSET_CACHE_H
+#define TSET_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+
+//LRU cache of decoded TSet rows, the (y,e) pairs TSet_Retrieve returns for a stag.
+//The server learns the stag and the row length of every query anyway, so serving a
+//repeated stag from here leaks nothing new. Safe to use from any number of threads.
+#define TSET_CACHE_DEFAULT_MB 256
+//Bookkeeping charged per cached row on top of its 48*n_ids bytes
+#define TSET_CACHE_ROW_OVERHEAD 128
+//Lookups between two statistics lines on stdout
+#define TSET_CACHE_REPORT 64
+
+struct TSetCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t n_rows;
+    size_t bytes;
+    size_t max_bytes;
+};
+
+//max_bytes of 0 turns the cache off, lookups then miss without locking or counting
+int TSetCache_Init(size_t max_bytes);
+int TSetCache_Release();
+
+//1 and the row copied into tset_row on a hit, 0 on a miss
+int TSetCache_Lookup(const unsigned char *stag, unsigned char *tset_row, int *n_ids_tset);
+int TSetCache_Insert(const unsigned char *stag, const unsigned char *tset_row, int n_ids_tset);
+
+int TSetCache_GetStats(TSetCacheStats *stats);
+int TSetCache_PrintStats();
+
+#endif // TSET_CACHE_H
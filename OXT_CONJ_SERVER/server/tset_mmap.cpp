@@ -0,0 +1,215 @@
+#include "tset_store.h"
+
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Entries received during setup, the table is sized and built from them in LoadEnd
+static std::vector<unsigned char> tset_pending;
+
+static unsigned char *tset_map = nullptr;
+static size_t tset_map_len = 0;
+static unsigned char *tset_slots = nullptr;
+static uint64_t tset_mask = 0;
+
+//Keys are mostly hash output already, the mix only spreads the jidx counter bytes
+static inline uint64_t TSetMmap_Hash(const unsigned char *key)
+{
+    uint64_t a, b;
+    ::memcpy(&a,key,8);
+    ::memcpy(&b,key+8,8);
+    uint64_t h = a ^ (b * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+static int TSetMmap_LoadBegin()
+{
+    tset_pending.clear();
+    return 0;
+}
+
+static int TSetMmap_LoadPut(const unsigned char *entries, size_t n)
+{
+    tset_pending.insert(tset_pending.end(),entries,entries+(TSET_ENTRY_LEN*n));
+    return 0;
+}
+
+//Written under a temporary name and renamed, a search server never maps a partial table
+static int TSetMmap_LoadEnd()
+{
+    uint64_t n_entries = tset_pending.size() / TSET_ENTRY_LEN;
+    uint64_t n_slots = TSET_MIN_SLOTS;
+    while(n_slots < 2*n_entries) n_slots <<= 1;
+
+    size_t file_len = TSET_FILE_HEADER_SIZE + (TSET_SLOT_LEN*n_slots);
+    std::string tmp_file = tset_store_file + ".tmp";
+
+    int fd = ::open(tmp_file.data(),O_RDWR | O_CREAT | O_TRUNC,0644);
+    if(fd < 0){
+        std::cout << "Could not open " << tmp_file << " for writing" << std::endl;
+        return -1;
+    }
+    if(::ftruncate(fd,file_len) < 0){
+        std::cout << "Could not size " << tmp_file << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    unsigned char *map = (unsigned char *)::mmap(nullptr,file_len,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    if(map == MAP_FAILED){
+        std::cout << "Could not map " << tmp_file << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    TSetFileHeader header;
+    ::memset(&header,0x00,sizeof(TSetFileHeader));
+    ::memcpy(header.magic,TSET_FILE_MAGIC,8);
+    header.version = TSET_FILE_VERSION;
+    header.slot_len = TSET_SLOT_LEN;
+    header.n_slots = n_slots;
+
+    //The file is zero filled, every slot starts out unused
+    unsigned char *slots = map + TSET_FILE_HEADER_SIZE;
+    uint64_t mask = n_slots - 1;
+    const unsigned char *entry = tset_pending.data();
+    for(uint64_t i=0;i<n_entries;++i){
+        uint64_t pos = TSetMmap_Hash(entry) & mask;
+        unsigned char *slot = slots + (TSET_SLOT_LEN*pos);
+        while(slot[TSET_ENTRY_LEN] && ::memcmp(slot,entry,TSET_KEY_LEN) != 0){
+            pos = (pos + 1) & mask;
+            slot = slots + (TSET_SLOT_LEN*pos);
+        }
+        //A repeated key replaces the earlier value, as a redis SET would
+        if(!slot[TSET_ENTRY_LEN]) ++header.n_entries;
+        ::memcpy(slot,entry,TSET_ENTRY_LEN);
+        slot[TSET_ENTRY_LEN] = 1;
+        entry += TSET_ENTRY_LEN;
+    }
+
+    ::memcpy(map,&header,sizeof(TSetFileHeader));
+
+    int ret = 0;
+    if(::msync(map,file_len,MS_SYNC) < 0) ret = -1;
+    ::munmap(map,file_len);
+    if(::close(fd) < 0) ret = -1;
+
+    if(ret == 0 && ::rename(tmp_file.data(),tset_store_file.data()) < 0) ret = -1;
+    if(ret < 0){
+        std::cout << "Could not write " << tset_store_file << std::endl;
+        return -1;
+    }
+
+    std::cout << "TSet store: " << header.n_entries << " entries in " << n_slots << " slots" << std::endl;
+
+    std::vector<unsigned char>().swap(tset_pending);
+
+    return 0;
+}
+
+static int TSetMmap_Open()
+{
+    int fd = ::open(tset_store_file.data(),O_RDONLY);
+    if(fd < 0){
+        std::cout << "Could not open " << tset_store_file << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if(::fstat(fd,&st) < 0 || (size_t)st.st_size < TSET_FILE_HEADER_SIZE){
+        std::cout << tset_store_file << " is not a TSet file" << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    unsigned char *map = (unsigned char *)::mmap(nullptr,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    ::close(fd);
+    if(map == MAP_FAILED){
+        std::cout << "Could not map " << tset_store_file << std::endl;
+        return -1;
+    }
+
+    TSetFileHeader header;
+    ::memcpy(&header,map,sizeof(TSetFileHeader));
+
+    bool valid = (::memcmp(header.magic,TSET_FILE_MAGIC,8) == 0) &&
+                 (header.version == TSET_FILE_VERSION) &&
+                 (header.slot_len == TSET_SLOT_LEN) &&
+                 (header.n_slots != 0) && ((header.n_slots & (header.n_slots - 1)) == 0) &&
+                 (header.n_entries < header.n_slots) &&
+                 ((size_t)st.st_size == TSET_FILE_HEADER_SIZE + (TSET_SLOT_LEN*header.n_slots));
+    if(!valid){
+        std::cout << tset_store_file << " is not a TSet file of this version" << std::endl;
+        ::munmap(map,st.st_size);
+        return -1;
+    }
+
+    //Lookups land on random slots
+    ::madvise(map,st.st_size,MADV_RANDOM);
+
+    tset_map = map;
+    tset_map_len = st.st_size;
+    tset_slots = map + TSET_FILE_HEADER_SIZE;
+    tset_mask = header.n_slots - 1;
+
+    std::cout << "TSet store: mapped " << header.n_entries << " entries" << std::endl;
+
+    return 0;
+}
+
+static int TSetMmap_Get(unsigned char *RES, const unsigned char *KEYS, unsigned char *HIT, unsigned int n)
+{
+    for(unsigned int i=0;i<n;++i){
+        const unsigned char *key = KEYS + (TSET_KEY_LEN*i);
+        uint64_t pos = TSetMmap_Hash(key) & tset_mask;
+        const unsigned char *slot = tset_slots + (TSET_SLOT_LEN*pos);
+
+        //At most half of the slots are used, so every probe sequence ends on an unused one
+        while(slot[TSET_ENTRY_LEN] && ::memcmp(slot,key,TSET_KEY_LEN) != 0){
+            pos = (pos + 1) & tset_mask;
+            slot = tset_slots + (TSET_SLOT_LEN*pos);
+        }
+
+        if(slot[TSET_ENTRY_LEN]){
+            ::memcpy(RES+(TSET_VAL_LEN*i),slot+TSET_KEY_LEN,TSET_VAL_LEN);
+            HIT[i] = 1;
+        }
+        else{
+            ::memset(RES+(TSET_VAL_LEN*i),0x00,TSET_VAL_LEN);
+            HIT[i] = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int TSetMmap_Close()
+{
+    if(tset_map != nullptr){
+        ::munmap(tset_map,tset_map_len);
+    }
+    tset_map = nullptr;
+    tset_map_len = 0;
+    tset_slots = nullptr;
+    tset_mask = 0;
+    return 0;
+}
+
+const TSetStoreOps tset_store_mmap = {
+    "mmap",
+    TSetMmap_LoadBegin,
+    TSetMmap_LoadPut,
+    TSetMmap_LoadEnd,
+    TSetMmap_Open,
+    TSetMmap_Get,
+    TSetMmap_Close
+};
@@ -0,0 +1,241 @@
+#include "tset_store.h"
+#include "mainwindow_server.h"
+
+static const TSetStoreOps *tset_store = &tset_store_redis;
+
+int TSetStore_Init(const std::string &backend)
+{
+    if(backend == tset_store_redis.name){
+        tset_store = &tset_store_redis;
+    }
+    else if(backend == tset_store_mmap.name){
+        tset_store = &tset_store_mmap;
+    }
+    else if(backend == tset_store_bucket.name){
+        tset_store = &tset_store_bucket;
+    }
+    else{
+        std::cout << "Unknown TSet store " << backend << std::endl;
+        return -1;
+    }
+
+    std::cout << "TSet store: " << tset_store->name << std::endl;
+    return 0;
+}
+
+const char *TSetStore_Name()
+{
+    return tset_store->name;
+}
+
+int TSetStore_LoadBegin()
+{
+    return tset_store->load_begin();
+}
+
+int TSetStore_LoadPut(const unsigned char *entries, size_t n)
+{
+    return tset_store->load_put(entries,n);
+}
+
+int TSetStore_LoadEnd()
+{
+    return tset_store->load_end();
+}
+
+int TSetStore_Open()
+{
+    return tset_store->open();
+}
+
+int TSetStore_Get(unsigned char *RES, const unsigned char *KEYS, unsigned char *HIT, unsigned int n)
+{
+    return tset_store->get(RES,KEYS,HIT,n);
+}
+
+int TSetStore_Close()
+{
+    return tset_store->close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//Shard addresses, and one handle per shard once the store is opened. Every handle has
+//its own connection pool, so a prefetch can run next to the main fetch
+static std::vector<std::pair<std::string,int>> tset_redis_addrs = {{"127.0.0.1",6379}};
+static std::vector<std::unique_ptr<Redis>> tset_redis;
+
+int TSetStore_SetRedisShards(const std::string &shards)
+{
+    std::vector<std::pair<std::string,int>> addrs;
+    std::stringstream ss(shards);
+    std::string addr;
+
+    while(std::getline(ss,addr,',')){
+        size_t colon = addr.rfind(':');
+        int port = 0;
+        if(colon != std::string::npos && colon > 0){
+            port = std::atoi(addr.data()+colon+1);
+        }
+        if(port <= 0 || port > 65535){
+            std::cout << "Bad redis shard " << addr << ", expected host:port" << std::endl;
+            return -1;
+        }
+        addrs.emplace_back(addr.substr(0,colon),port);
+    }
+
+    if(addrs.empty() || addrs.size() > TSET_REDIS_MAX_SHARDS){
+        std::cout << "Between 1 and " << TSET_REDIS_MAX_SHARDS << " redis shards are supported" << std::endl;
+        return -1;
+    }
+
+    tset_redis_addrs.swap(addrs);
+    return 0;
+}
+
+static inline unsigned int TSetRedis_Shard(const unsigned char *key)
+{
+    return ((key[1] << 8) + key[0]) % tset_redis.size();
+}
+
+//Runs body(shard) for every shard with work, all but the last one on their own thread
+static void TSetRedis_ForShards(const std::vector<bool> &busy, const std::function<void(unsigned int)> &body)
+{
+    std::vector<std::future<void>> pending;
+    int last = -1;
+
+    for(unsigned int sh=0;sh<busy.size();++sh){
+        if(!busy[sh]) continue;
+        if(last >= 0){
+            pending.push_back(std::async(std::launch::async,body,(unsigned int)last));
+        }
+        last = sh;
+    }
+    if(last >= 0){
+        body(last);
+    }
+    for(std::future<void> &f : pending){
+        f.get();
+    }
+}
+
+static int TSetRedis_Connect()
+{
+    if(!tset_redis.empty()) return 0;
+
+    for(const std::pair<std::string,int> &addr : tset_redis_addrs){
+        ConnectionOptions options = connection_options;
+        options.host = addr.first;
+        options.port = addr.second;
+        tset_redis.emplace_back(new Redis(options,pool_options));
+    }
+
+    std::cout << "TSet store: " << tset_redis.size() << " redis shard(s)" << std::endl;
+    return 0;
+}
+
+static int TSetRedis_LoadBegin()
+{
+    return TSetRedis_Connect();
+}
+
+static int TSetRedis_LoadPut(const unsigned char *entries, size_t n)
+{
+    if(n == 0) return 0;
+
+    unsigned int n_shards = tset_redis.size();
+    std::vector<std::vector<std::pair<StringView,StringView>>> kv(n_shards);
+    std::vector<bool> busy(n_shards,false);
+
+    const char *entry = reinterpret_cast<const char *>(entries);
+    for(size_t i=0;i<n;++i){
+        unsigned int sh = TSetRedis_Shard((const unsigned char *)entry);
+        kv[sh].emplace_back(StringView(entry,TSET_KEY_LEN),StringView(entry+TSET_KEY_LEN,TSET_VAL_LEN));
+        busy[sh] = true;
+        entry += TSET_ENTRY_LEN;
+    }
+
+    try{
+        TSetRedis_ForShards(busy,[&](unsigned int sh){
+            tset_redis[sh]->mset(kv[sh].begin(),kv[sh].end());
+        });
+    }
+    catch(const Error &e){
+        std::cout << "TSet store: redis MSET failed: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int TSetRedis_LoadEnd()
+{
+    return 0;
+}
+
+static int TSetRedis_Open()
+{
+    return TSetRedis_Connect();
+}
+
+static int TSetRedis_Get(unsigned char *RES, const unsigned char *KEYS, unsigned char *HIT, unsigned int n)
+{
+    unsigned int n_shards = tset_redis.size();
+    std::vector<std::vector<StringView>> keys(n_shards);
+    std::vector<std::vector<unsigned int>> pos(n_shards);//index in KEYS of every key of a shard
+    std::vector<std::vector<OptionalString>> vals(n_shards);
+    std::vector<bool> busy(n_shards,false);
+
+    for(unsigned int i=0;i<n;++i){
+        const unsigned char *key = KEYS+(TSET_KEY_LEN*i);
+        unsigned int sh = TSetRedis_Shard(key);
+        keys[sh].emplace_back(reinterpret_cast<const char *>(key),TSET_KEY_LEN);
+        pos[sh].push_back(i);
+        busy[sh] = true;
+    }
+
+    int ret = 0;
+    try{
+        TSetRedis_ForShards(busy,[&](unsigned int sh){
+            vals[sh].reserve(keys[sh].size());
+            tset_redis[sh]->mget(keys[sh].begin(),keys[sh].end(),std::back_inserter(vals[sh]));
+        });
+    }
+    catch(const Error &e){
+        //Keys of the failed shards come back as misses
+        std::cout << "TSet store: redis MGET failed: " << e.what() << std::endl;
+        ret = -1;
+    }
+
+    for(unsigned int sh=0;sh<n_shards;++sh){
+        for(size_t k=0;k<pos[sh].size();++k){
+            unsigned int i = pos[sh][k];
+            if(k < vals[sh].size() && vals[sh][k] && vals[sh][k]->size() == TSET_VAL_LEN){
+                ::memcpy(RES+(TSET_VAL_LEN*i),vals[sh][k]->data(),TSET_VAL_LEN);
+                HIT[i] = 1;
+            }
+            else{
+                ::memset(RES+(TSET_VAL_LEN*i),0x00,TSET_VAL_LEN);
+                HIT[i] = 0;
+            }
+        }
+    }
+
+    return ret;
+}
+
+static int TSetRedis_Close()
+{
+    tset_redis.clear();
+    return 0;
+}
+
+const TSetStoreOps tset_store_redis = {
+    "redis",
+    TSetRedis_LoadBegin,
+    TSetRedis_LoadPut,
+    TSetRedis_LoadEnd,
+    TSetRedis_Open,
+    TSetRedis_Get,
+    TSetRedis_Close
+};
@@ -0,0 +1,93 @@
+#ifndef TSET_STORE_H
+#define TSET_STORE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+//TSet entries are raw bytes: key = bidx(2) || jidx(2) || label(12), value = beta || e,y (49)
+#define TSET_KEY_LEN 16
+#define TSET_VAL_LEN 49
+#define TSET_ENTRY_LEN (TSET_KEY_LEN + TSET_VAL_LEN)
+
+//Backend of the TSet, picked once at startup by TSetStore_Init. Setup loads entries
+//through LoadBegin/Put/End, search opens the store and looks keys up with Get, which
+//may be called from any number of threads at once.
+//  redis: the entries in one or more redis servers, sharded by bidx % n_shards.
+//         Every shard is loaded and queried in parallel with MSET/MGET
+//  mmap:  open addressing hash table keyed by the raw 16 byte key in tset_store_file,
+//         built at the end of setup and mapped read-only by the search server
+//  bucket: 65536 buckets of S slots in tset_store_file, addressed by the bidx and
+//         jidx of the key without hashing, mapped like the mmap store
+struct TSetStoreOps {
+    const char *name;
+    int (*load_begin)();
+    int (*load_put)(const unsigned char *entries, size_t n);//n key || value entries
+    int (*load_end)();
+    int (*open)();
+    int (*get)(unsigned char *RES, const unsigned char *KEYS, unsigned char *HIT, unsigned int n);
+    int (*close)();
+};
+
+extern std::string tset_store_file;
+
+extern const TSetStoreOps tset_store_redis;
+extern const TSetStoreOps tset_store_mmap;
+extern const TSetStoreOps tset_store_bucket;
+
+//mmap file: a 64 byte header followed by n_slots slots of
+//  key(16) || value(49) || used(1) || reserved(14)
+//n_slots is a power of two at least twice the number of entries, linear probing
+#define TSET_FILE_MAGIC "OXTTSET "
+#define TSET_FILE_VERSION 1
+#define TSET_FILE_HEADER_SIZE 64
+#define TSET_SLOT_LEN 80
+#define TSET_MIN_SLOTS 1024
+
+struct TSetFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_len;
+    uint64_t n_slots;
+    uint64_t n_entries;
+};
+
+//bucket file: a 64 byte header followed by TSET_N_BUCKETS*n_bucket_slots slots of
+//  jidx(2) || label(12) || value(49) || used(1)
+//one cache line each. The entry of key bidx || jidx || label sits in bucket bidx at
+//slot jidx, or the next free slot after it (wrapping in the bucket) when an entry of
+//another row took that place. S is the smallest size that fits every bucket.
+#define TSET_BUCKET_MAGIC "OXTTBKT "
+#define TSET_BUCKET_VERSION 1
+#define TSET_N_BUCKETS 65536
+#define TSET_BUCKET_SLOT_LEN 64
+
+struct TSetBucketHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_len;
+    uint32_t n_buckets;
+    uint32_t n_bucket_slots;
+    uint64_t n_entries;
+};
+
+//Shards of the redis store
+#define TSET_REDIS_MAX_SHARDS 64
+
+//backend is "redis", "mmap" or "bucket", -1 for anything else
+int TSetStore_Init(const std::string &backend);
+//Comma separated host:port list of the redis shards, 127.0.0.1:6379 unless set.
+//Setup and search have to use the same list in the same order.
+int TSetStore_SetRedisShards(const std::string &shards);
+const char *TSetStore_Name();
+
+int TSetStore_LoadBegin();
+int TSetStore_LoadPut(const unsigned char *entries, size_t n);
+int TSetStore_LoadEnd();
+
+int TSetStore_Open();
+//RES gets the value of KEYS[i] and HIT[i] = 1, or zeros and HIT[i] = 0 if it is not stored
+int TSetStore_Get(unsigned char *RES, const unsigned char *KEYS, unsigned char *HIT, unsigned int n);
+int TSetStore_Close();
+
+#endif // TSET_STORE_H